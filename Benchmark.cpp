@@ -0,0 +1,287 @@
+import TaskSchedulingModule;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Micro benchmarks for the task scheduler, printed in the same format as Google Benchmark.
+// No external dependencies, so it builds wherever `TaskSchedulingModule` builds (see README).
+//
+// Usage: benchmark [--benchmark_filter=<substring>] [--benchmark_min_time=<seconds>]
+
+class BenchmarkState
+{
+public:
+    BenchmarkState(uint64_t iterations, int64_t arg) : iterations(iterations), arg(arg) {}
+
+    // Exclude setup/teardown from the measured time
+    void PauseTiming() { mElapsed += std::chrono::steady_clock::now() - mStart; }
+    void ResumeTiming() { mStart = std::chrono::steady_clock::now(); }
+
+    // Replace the measured time of an iteration, for things that happen on another thread
+    void SetIterationTime(std::chrono::nanoseconds time) { mManualTime += time; mUseManualTime = true; }
+
+    const uint64_t iterations;
+    const int64_t arg;
+    uint64_t itemsProcessed = 0U;
+    std::map<std::string, double> counters;
+
+private:
+    friend struct BenchmarkRunner;
+    std::chrono::steady_clock::time_point mStart;
+    std::chrono::steady_clock::duration mElapsed {};
+    std::chrono::nanoseconds mManualTime {};
+    bool mUseManualTime = false;
+};
+
+struct Benchmark
+{
+    std::string name;
+    std::function<void(BenchmarkState&)> function;
+    std::vector<int64_t> args;
+};
+
+struct BenchmarkRunner
+{
+    std::chrono::duration<double> minTime {0.5};
+
+    void Run(const Benchmark& benchmark, int64_t arg)
+    {
+        const std::string name = benchmark.name + "/" + std::to_string(arg);
+        uint64_t iterations = 1U;
+        while (true)
+        {
+            BenchmarkState state(iterations, arg);
+            const auto wallStart = std::chrono::steady_clock::now();
+            state.ResumeTiming();
+            benchmark.function(state);
+            state.PauseTiming();
+            const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wallStart;
+
+            const std::chrono::duration<double> elapsed = state.mUseManualTime
+                ? std::chrono::duration<double>(state.mManualTime)
+                : std::chrono::duration<double>(state.mElapsed);
+
+            // Same growth strategy as Google Benchmark: aim a bit above `minTime`, at most 10x per step.
+            // Benchmarks with long untimed setup (sleeping until expiry) are capped by wall time.
+            if (elapsed < minTime && wall < minTime * 10.0 && iterations < 1000000000U)
+            {
+                const double scale = elapsed.count() > 0.0 ? (minTime / elapsed) * 1.4 : 10.0;
+                iterations = std::max(iterations + 1U, static_cast<uint64_t>(iterations * std::min(scale, 10.0)));
+                continue;
+            }
+
+            const double nsPerIteration = elapsed.count() * 1e9 / static_cast<double>(iterations);
+            std::printf("%-40s %12.0f ns %12llu", name.c_str(), nsPerIteration, static_cast<unsigned long long>(iterations));
+            if (state.itemsProcessed > 0U)
+            {
+                std::printf(" items_per_second=%.4gM/s", static_cast<double>(state.itemsProcessed) / elapsed.count() / 1e6);
+            }
+            for (const auto& [counter, value] : state.counters)
+            {
+                std::printf(" %s=%.4g", counter.c_str(), value);
+            }
+            std::printf("\n");
+            return;
+        }
+    }
+};
+
+
+// Far enough in the future to never expire while measuring
+constexpr auto kNever = 1h;
+
+// Largest container the scheduler supports (`TaskSchedulerInfo::maxSize`)
+constexpr int64_t kMaxPending = 65535;
+
+std::atomic_uint64_t gExecuted = 0U;
+
+void noop_task()
+{
+    gExecuted.fetch_add(1U, std::memory_order_relaxed);
+}
+
+void wait_for_executed(uint64_t count)
+{
+    while (gExecuted.load(std::memory_order_relaxed) < count) { std::this_thread::yield(); }
+}
+
+TaskSchedulerInfo make_info(int64_t maxSize, uint8_t numParallelThreads)
+{
+    TaskSchedulerInfo info;
+    info.maxSize = static_cast<uint16_t>(maxSize);
+    info.numParallelThreads = numParallelThreads;
+    return info;
+}
+
+// Cost of inserting `arg` tasks (and draining them into the container with one `ProcessTasks`)
+void BM_AddTimedTask(BenchmarkState& state)
+{
+    for (uint64_t i = 0; i < state.iterations; i++)
+    {
+        state.PauseTiming();
+        TaskScheduler scheduler(make_info(state.arg, 0U));
+        state.ResumeTiming();
+
+        for (int64_t t = 0; t < state.arg; t++)
+        {
+            scheduler.AddTimedTask(kNever, { &noop_task, true });
+        }
+        scheduler.ProcessTasks();
+
+        state.PauseTiming();
+        scheduler.Terminate();
+        state.ResumeTiming();
+    }
+    state.itemsProcessed = state.iterations * static_cast<uint64_t>(state.arg);
+}
+
+// Per-frame cost with `arg` pending tasks of which none expire
+void BM_ProcessTasksPending(BenchmarkState& state)
+{
+    state.PauseTiming();
+    TaskScheduler scheduler(make_info(state.arg, 0U));
+    for (int64_t t = 0; t < state.arg; t++)
+    {
+        scheduler.AddTimedTask(kNever, { &noop_task, true });
+    }
+    scheduler.ProcessTasks();
+    state.ResumeTiming();
+
+    for (uint64_t i = 0; i < state.iterations; i++)
+    {
+        scheduler.ProcessTasks();
+    }
+
+    state.PauseTiming();
+    scheduler.Terminate();
+    state.ResumeTiming();
+    state.itemsProcessed = state.iterations * static_cast<uint64_t>(state.arg);
+}
+
+// One frame in which `arg` tasks expire at once, either all on the main thread or all dispatched
+// to the parallel runner (only the dispatch is measured, not the execution on the workers).
+void expiry_burst(BenchmarkState& state, bool forceSynchronous)
+{
+    TaskScheduler scheduler(make_info(state.arg, forceSynchronous ? 0U : 4U));
+    // long enough that inserting and draining them all finishes before the first one expires
+    const auto delay = 100us + std::chrono::microseconds(state.arg);
+    for (uint64_t i = 0; i < state.iterations; i++)
+    {
+        state.PauseTiming();
+        const uint64_t expected = gExecuted.load() + static_cast<uint64_t>(state.arg);
+        for (int64_t t = 0; t < state.arg; t++)
+        {
+            scheduler.AddTimedTask(delay, { &noop_task, forceSynchronous });
+        }
+        const auto lastAdded = std::chrono::steady_clock::now();
+        scheduler.ProcessTasks(); // moves them into the container
+        std::this_thread::sleep_until(lastAdded + delay);
+        state.ResumeTiming();
+
+        scheduler.ProcessTasks();
+
+        state.PauseTiming();
+        wait_for_executed(expected);
+        state.ResumeTiming();
+    }
+    state.PauseTiming();
+    scheduler.Terminate();
+    state.ResumeTiming();
+    state.itemsProcessed = state.iterations * static_cast<uint64_t>(state.arg);
+}
+
+void BM_ExpiryBurstMain(BenchmarkState& state) { expiry_burst(state, true); }
+void BM_ExpiryBurstParallel(BenchmarkState& state) { expiry_burst(state, false); }
+
+// Time from the `ProcessTasks` call which dispatches a parallel task until a worker starts running
+// it, with `arg` workers and as many tasks per frame.
+void BM_DispatchLatency(BenchmarkState& state)
+{
+    const int64_t workers = state.arg;
+    TaskScheduler scheduler(make_info(64, static_cast<uint8_t>(workers)));
+    std::vector<std::atomic<std::chrono::steady_clock::rep>> starts(static_cast<size_t>(workers));
+    std::vector<double> samples;
+    samples.reserve(static_cast<size_t>(std::min<uint64_t>(state.iterations, 1000000U) * workers));
+
+    for (uint64_t i = 0; i < state.iterations; i++)
+    {
+        for (auto& start : starts) { start.store(0); }
+        for (int64_t w = 0; w < workers; w++)
+        {
+            scheduler.AddTimedTask(0ns, { [&starts, w] {
+                starts[w].store(std::chrono::steady_clock::now().time_since_epoch().count());
+            }, false });
+        }
+
+        const auto dispatched = std::chrono::steady_clock::now();
+        scheduler.ProcessTasks();
+
+        std::chrono::nanoseconds worst {0};
+        for (auto& start : starts)
+        {
+            while (start.load() == 0) { std::this_thread::yield(); }
+            const std::chrono::steady_clock::time_point started { std::chrono::steady_clock::duration(start.load()) };
+            const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(started - dispatched);
+            worst = std::max(worst, latency);
+            if (samples.size() < samples.capacity()) { samples.push_back(static_cast<double>(latency.count())); }
+        }
+        state.SetIterationTime(worst);
+    }
+    scheduler.Terminate();
+
+    std::sort(samples.begin(), samples.end());
+    state.counters["p50_us"] = samples[samples.size() / 2] / 1e3;
+    state.counters["p99_us"] = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)] / 1e3;
+    state.counters["max_us"] = samples.back() / 1e3;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkRunner runner;
+    std::string_view filter;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        if (arg.starts_with("--benchmark_filter=")) { filter = arg.substr(19); }
+        else if (arg.starts_with("--benchmark_min_time=")) { runner.minTime = std::chrono::duration<double>(std::atof(argv[i] + 21)); }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--benchmark_filter=<substring>] [--benchmark_min_time=<seconds>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<int64_t> workerCounts;
+    const int64_t hardwareThreads = std::clamp<int64_t>(std::thread::hardware_concurrency(), 1, 255);
+    for (int64_t w = 1; w < hardwareThreads; w *= 2) { workerCounts.push_back(w); }
+    workerCounts.push_back(hardwareThreads);
+
+    const std::vector<Benchmark> benchmarks {
+        { "BM_AddTimedTask", &BM_AddTimedTask, { 64, 4096, kMaxPending } },
+        { "BM_ProcessTasksPending", &BM_ProcessTasksPending, { 64, 512, 4096, 32768, kMaxPending } },
+        { "BM_ExpiryBurstMain", &BM_ExpiryBurstMain, { 64, 4096, kMaxPending } },
+        { "BM_ExpiryBurstParallel", &BM_ExpiryBurstParallel, { 64, 4096, kMaxPending } },
+        { "BM_DispatchLatency", &BM_DispatchLatency, workerCounts },
+    };
+
+    std::printf("%-40s %15s %12s\n", "Benchmark", "Time", "Iterations");
+    std::printf("%s\n", std::string(70, '-').c_str());
+    for (const Benchmark& benchmark : benchmarks)
+    {
+        if (benchmark.name.find(filter) == std::string::npos) { continue; }
+        for (const int64_t arg : benchmark.args)
+        {
+            runner.Run(benchmark, arg);
+        }
+    }
+    return 0;
+}
@@ -29,6 +29,7 @@ int main(int argc, char* argv[])
     // TODO: Here we could go crazy and reserve 1 main thread, 1 audio thread, 1 physics thread, and
     // TODO: dedicate what's left (std::thread::hardware_concurrency() - 3) for parallel task execution.
     info.numParallelThreads = 4U; // Try 0 for only synchronous!
+    info.parallelTimerThread = true; // parallel tasks fire on time, not on the next (1s) frame
     TaskScheduler taskScheduler(info);
 
     for (int i = 0; i < 10; i++) { taskScheduler.AddTimedTask(5s, { &parallel_sayhi, false }); }
@@ -41,6 +42,7 @@ int main(int argc, char* argv[])
         // Possibly game loop stuff here
         std::cout << "Processing...\n";
 
+        // NOTE: Without a frame loop, `taskScheduler.RunUntil(stopToken)` sleeps until the next deadline instead.
         std::this_thread::sleep_for(1000ms); // frame limiter
     }
 
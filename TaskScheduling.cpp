@@ -22,37 +22,308 @@
 
 module;
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdio>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <deque>
+#include <ostream>
 #include <queue>
-#include <semaphore>
-#include <unordered_set>
+#include <stop_token>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+// Diagnostics below this level are compiled out: 0 = Debug, 1 = Info, 2 = Warning, 3 = Error, 4 = none
+#ifndef TASK_SCHEDULING_MIN_LOG_LEVEL
+#define TASK_SCHEDULING_MIN_LOG_LEVEL 1
+#endif
 
 export module TaskSchedulingModule;
 
 export using namespace std::chrono_literals;
 
 
+// Slab allocator for callback closures which do not fit into `TaskCallback` itself. Blocks come in
+// a few size classes, are carved from slabs that are never returned to the heap, and are recycled
+// through a per-thread cache (a worker freeing a callback takes no lock) backed by a central list.
+class CallbackPool // not exported
+{
+public:
+    CallbackPool(uint32_t blocksPerSlab);
+    ~CallbackPool();
+    CallbackPool(const CallbackPool&) = delete;
+    CallbackPool& operator=(const CallbackPool&) = delete;
+
+    void* Allocate(size_t size); // max_align_t aligned, oversized requests go to the heap
+    static void Free(void* block);
+    static CallbackPool* Owner(const void* block);
+    void FlushThreadCache(); // the calling thread's cached blocks go back to the central lists
+
+private:
+    static constexpr uint32_t kNumSizeClasses = 4U; // 64, 128, 256 and 512 bytes including the header
+    static constexpr uint32_t kOversized = kNumSizeClasses;
+    static constexpr uint32_t kMaxCached = 64U; // per thread and size class, half is returned beyond
+    struct alignas(std::max_align_t) Header
+    {
+        CallbackPool* pool;
+        uint32_t sizeClass;
+    };
+    struct FreeBlock { FreeBlock* next; }; // overlays the header of a free block
+    struct ThreadCache
+    {
+        std::thread::id thread;
+        std::array<FreeBlock*, kNumSizeClasses> blocks {};
+        std::array<uint32_t, kNumSizeClasses> counts {};
+    };
+    static constexpr size_t BlockSize(uint32_t sizeClass) { return size_t(64U) << sizeClass; }
+    ThreadCache& GetThreadCache();
+    void Release(Header* header);
+
+    const uint64_t mId; // unique, so thread-local cache lookups never match a destroyed pool
+    const uint32_t mBlocksPerSlab;
+    std::mutex mMutex; // guards everything below
+    std::array<FreeBlock*, kNumSizeClasses> mCentral {};
+    std::vector<std::unique_ptr<std::max_align_t[]>> mSlabs;
+    std::vector<std::unique_ptr<ThreadCache>> mCaches; // only ever touched by their own thread
+};
+
+// Shared by all callbacks created without a pool, see `TaskCallback`. Never destroyed, so tasks in
+// schedulers with static storage duration can still release their callbacks at exit.
+CallbackPool& DefaultCallbackPool(); // not exported
+
+// Copyable `void()` callable, like std::function, but closures up to `kInlineSize` bytes are stored
+// in place and bigger ones in a `CallbackPool`, so creating, copying and destroying tasks does not
+// touch the global heap (besides the occasional new slab). Plain lambdas and function pointers
+// convert implicitly and use a pool shared by all schedulers, `TaskScheduler::MakeCallback` uses
+// the pool of that scheduler instead.
+export class TaskCallback
+{
+public:
+    static constexpr size_t kInlineSize = 48U;
+
+    TaskCallback() = default;
+    TaskCallback(std::nullptr_t) {}
+    template <typename F>
+        requires (!std::is_same_v<std::decay_t<F>, TaskCallback> && std::is_invocable_v<std::decay_t<F>&>)
+    TaskCallback(F&& function) : TaskCallback(DefaultCallbackPool(), std::forward<F>(function)) {}
+    template <typename F>
+    TaskCallback(CallbackPool& pool, F&& function)
+    {
+        using Fn = std::decay_t<F>;
+        static_assert(alignof(Fn) <= alignof(std::max_align_t), "over-aligned callbacks are not supported");
+        if constexpr (std::is_pointer_v<Fn>)
+        {
+            if (function == nullptr) { return; } // like std::function, a null pointer is empty
+        }
+        if constexpr (!Fits<Fn>()) { mHeap = pool.Allocate(sizeof(Fn)); }
+        ::new (Target()) Fn(std::forward<F>(function));
+        mOps = &kOps<Fn>;
+    }
+    TaskCallback(const TaskCallback& other) { CopyFrom(other); }
+    TaskCallback(TaskCallback&& other) noexcept { MoveFrom(other); }
+    TaskCallback& operator=(const TaskCallback& other)
+    {
+        if (this != &other) { Reset(); CopyFrom(other); }
+        return *this;
+    }
+    TaskCallback& operator=(TaskCallback&& other) noexcept
+    {
+        if (this != &other) { Reset(); MoveFrom(other); }
+        return *this;
+    }
+    TaskCallback& operator=(std::nullptr_t) { Reset(); return *this; }
+    ~TaskCallback() { Reset(); }
+
+    void operator()() const { mOps->invoke(Target()); }
+    explicit operator bool() const { return mOps != nullptr; }
+    bool operator==(std::nullptr_t) const { return mOps == nullptr; }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void* target);
+        void (*copy)(void* destination, const void* source);
+        void (*move)(void* destination, void* source); // and destroys the source
+        void (*destroy)(void* target);
+        size_t size;
+    };
+    template <typename Fn>
+    static constexpr bool Fits()
+    {
+        return sizeof(Fn) <= kInlineSize && std::is_nothrow_move_constructible_v<Fn>;
+    }
+    template <typename Fn>
+    static constexpr Ops kOps {
+        [](void* target) { (*static_cast<Fn*>(target))(); },
+        [](void* destination, const void* source) { ::new (destination) Fn(*static_cast<const Fn*>(source)); },
+        [](void* destination, void* source) { ::new (destination) Fn(std::move(*static_cast<Fn*>(source))); static_cast<Fn*>(source)->~Fn(); },
+        [](void* target) { static_cast<Fn*>(target)->~Fn(); },
+        sizeof(Fn),
+    };
+
+    void* Target() const { return mHeap != nullptr ? mHeap : const_cast<unsigned char*>(mInline); }
+    void Reset()
+    {
+        if (mOps == nullptr) { return; }
+        mOps->destroy(Target());
+        if (mHeap != nullptr) { CallbackPool::Free(mHeap); }
+        mOps = nullptr;
+        mHeap = nullptr;
+    }
+    void CopyFrom(const TaskCallback& other)
+    {
+        if (other.mOps == nullptr) { return; }
+        // a copy stays in the pool of the original
+        if (other.mHeap != nullptr) { mHeap = CallbackPool::Owner(other.mHeap)->Allocate(other.mOps->size); }
+        other.mOps->copy(Target(), other.Target());
+        mOps = other.mOps;
+    }
+    void MoveFrom(TaskCallback& other)
+    {
+        if (other.mOps == nullptr) { return; }
+        if (other.mHeap != nullptr) { mHeap = other.mHeap; } // steal the block
+        else { other.mOps->move(mInline, other.mInline); }
+        mOps = other.mOps;
+        other.mOps = nullptr;
+        other.mHeap = nullptr;
+    }
+
+    const Ops* mOps = nullptr;
+    void* mHeap = nullptr; // nullptr => stored in `mInline`
+    alignas(std::max_align_t) unsigned char mInline[kInlineSize];
+};
+
+
+export class TaskScheduler;
+class ParallelTaskRunner;
+class ParallelTimer;
+
+// Fork-join counter, e.g. for the parallel jobs of a frame: pending while any of its tasks waits
+// for its deadline, is queued or runs. A task completes by running, or by being dropped (full
+// container, `Terminate`). Periodic tasks count per occurrence, from when it fires. Counting is a
+// relaxed atomic add/sub, no allocations. Must outlive its tasks.
+export class TaskGroup
+{
+public:
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    // For polling from the frame loop. Once true, the scheduler does not touch the group anymore
+    // (until new tasks are added), so it may be destroyed right away.
+    bool IsDone() const { return mPending.load(std::memory_order_acquire) == 0U; }
+    uint32_t GetPending() const { return mPending.load(std::memory_order_relaxed); }
+
+private:
+    friend class TaskScheduler;
+    friend class ParallelTaskRunner;
+    friend class ParallelTimer;
+    void Enter() { mPending.fetch_add(1U, std::memory_order_relaxed); }
+    bool Leave() { return mPending.fetch_sub(1U, std::memory_order_acq_rel) == 1U; } // true if that was the last
+
+    std::atomic_uint32_t mPending {0U};
+};
+
+// Where a task runs, for `TaskScheduler::EmplaceTimedTask` (see `TaskInfo::forceSynchronous`)
+export enum class TaskLane
+{
+    Main,
+    Parallel,
+};
+
+// How urgent a task is, for `OverflowPolicy::DropLowestPriority`
+export enum class TaskPriority : uint8_t
+{
+    Low,
+    Normal,
+    High,
+    Critical,
+};
+
 export struct TaskInfo
 {
-    std::function<void()> callback = nullptr;
+    TaskCallback callback = nullptr;
     bool forceSynchronous = true; // true => run on main thread; false => run on parallel thread
+    // The task may fire up to `slack` after its deadline (like Linux timer slack). Wakeups from
+    // `WaitForNextDeadline`/`GetPollFd` are postponed as far as the slack of all tasks allows, so
+    // timers with nearby deadlines share one wakeup and are dispatched in the same batch.
+    std::chrono::nanoseconds slack {0};
+    const char* tag = nullptr; // shown in traces, see `TaskScheduler::DumpTrace`. Must outlive the task.
+    // Non-zero makes the task periodic: after firing it is rescheduled at `deadline + period`
+    // (see `CatchUpPolicy::SkipMissedPeriodic`), until the scheduler is terminated.
+    std::chrono::nanoseconds period {0};
+    // Parallel tasks with the same non-zero strand (e.g. an entity or connection id) never run
+    // concurrently, and run in the order they were dispatched, so their shared state needs no lock.
+    // Different strands still run in parallel. Ignored on the main thread, which is serial anyway.
+    uint64_t strand {0U};
+    // Resources the callback reads and writes, one bit each (what a bit stands for is up to you).
+    // A writer never runs concurrently with another task reading or writing any of its resources,
+    // readers of the same resource may, and a task is never overtaken by a later one it conflicts
+    // with. Main-thread tasks declaring resources wait for conflicting parallel tasks as well, so
+    // tasks which are only synchronous to avoid data races can run in parallel instead.
+    uint64_t reads {0U};
+    uint64_t writes {0U};
+    TaskGroup* group = nullptr; // see `TaskScheduler::Wait`
+    TaskPriority priority = TaskPriority::Normal;
+    // Non-zero drops a parallel task which is dispatched, or would start, later than `deadline +
+    // maxStaleness` (e.g. AI replanning, worthless when late). `onStale` runs instead, if set.
+    std::chrono::nanoseconds maxStaleness {0};
+    TaskCallback onStale = nullptr;
+    // When the task should be done by, relative to its deadline. Only orders the parallel queue
+    // with `QueueOrder::EarliestDeadlineFirst`, so e.g. a long task can be started before short
+    // ones due at the same time.
+    std::chrono::nanoseconds completeWithin {0};
 };
 
 struct TimedTaskInfo
 {
     TaskInfo taskInfo;
-    std::chrono::milliseconds duration;
+    std::chrono::time_point<std::chrono::steady_clock> deadline;
+    uint64_t sequence {0U}; // unique per inserted task, in insertion order
+    // Set when deferred by `OverloadAction::Defer`: fires no earlier, while lateness and staleness
+    // are still measured from `deadline`
+    std::chrono::time_point<std::chrono::steady_clock> notBefore {};
 };
 
 
+std::chrono::time_point<std::chrono::steady_clock> FireTime(const TimedTaskInfo& task) // not exported
+{
+    return std::max(task.deadline, task.notBefore);
+}
+
+// Firing order of due tasks: earliest (see `FireTime`) first, ties broken by insertion order
+bool FiresBefore(const TimedTaskInfo& a, const TimedTaskInfo& b) // not exported
+{
+    const auto aFires = FireTime(a);
+    const auto bFires = FireTime(b);
+    return (aFires != bFires) ? (aFires < bFires) : (a.sequence < b.sequence);
+}
+
+
 struct ContainerItem // not exported
 {
     TimedTaskInfo element {};
     ContainerItem& operator=(const TimedTaskInfo& other) { element = other; return *this; }
+    ContainerItem& operator=(TimedTaskInfo&& other) { element = std::move(other); return *this; }
 };
 
 class TaskContainer
@@ -61,6 +332,7 @@ public:
     TaskContainer(uint16_t size);
     ~TaskContainer();
     bool Insert(const TimedTaskInfo& elem);
+    bool Insert(TimedTaskInfo&& elem);
     void ForEach(const std::function<bool(TimedTaskInfo&)>& iterate); // iterate returns 'true' is element should be removed
     void PostIterate(); // cleanup any elements marked as so
 
@@ -69,17 +341,21 @@ private:
     // Basically I want to avoid copying task objects around, so they are stored only in `mList`,
     // while `mFreeList` and `mRemovals` contain indices hereinto.
     //
-    // The unordered_set `mAllocated` contains a set of indices into `mList` that are currently allocated.
-    // When a task is executed it gets removed from this set and placed into `mFreeList`,
+    // The dense array `mAllocated` contains the indices into `mList` that are currently allocated,
+    // and `mPositions` tells where in `mAllocated` each index is, so removal is a swap with the last.
+    // When a task is executed it gets removed from this array and placed into `mFreeList`,
     // where the free-list is implemented in a linear array as a stack.
     //
     // These efforts are to ensure a good runtime performance, since the functions `ForEach` and
     // `PostIterate` are called _each_ frame, so they should do as little memory juggling as possible.
-    // Insertion is always a constant-time operation.
+    // Insertion is always a constant-time operation. Iteration order is NOT meaningful, the scheduler
+    // sorts whatever expired by (deadline, sequence) itself.
 
     ContainerItem* mList;
     const uint16_t mSize; // space for max mSize tasks at any given time
-    std::unordered_set<uint16_t> mAllocated;
+    uint16_t* mAllocated;
+    uint16_t* mPositions;
+    uint16_t mAllocatedCount;
 
     // free-list implemented as a stack (probably better cache performance)
     uint16_t* mFreeList;
@@ -91,28 +367,500 @@ private:
 };
 
 
+// Source of time for deadlines. Inject a `ManualClock` to run simulations faster than real time,
+// replay deterministically, or test without sleeping.
+export class Clock
+{
+public:
+    using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+    virtual ~Clock() = default;
+    virtual TimePoint Now() const = 0;
+    // Called by `TaskScheduler::WaitForNextDeadline` instead of sleeping until `time`. A real clock
+    // cannot do that and returns false; a virtual clock jumps forward and returns true.
+    virtual bool SkipTo(TimePoint time) { (void)time; return false; }
+};
+
+export class SteadyClock final : public Clock
+{
+public:
+    TimePoint Now() const override { return std::chrono::steady_clock::now(); }
+};
+
+// Only moves when told to. Thread safe, as tasks may be added from any thread.
+export class ManualClock final : public Clock
+{
+public:
+    ManualClock(TimePoint start = {}) : mNow(start.time_since_epoch().count()) {}
+    TimePoint Now() const override { return TimePoint(TimePoint::duration(mNow.load(std::memory_order_acquire))); }
+    bool SkipTo(TimePoint time) override { Set(std::max(time, Now())); return true; }
+    void Set(TimePoint time) { mNow.store(time.time_since_epoch().count(), std::memory_order_release); }
+    void Advance(std::chrono::nanoseconds delta)
+    {
+        mNow.fetch_add(std::chrono::duration_cast<TimePoint::duration>(delta).count(), std::memory_order_acq_rel);
+    }
+
+private:
+    std::atomic<TimePoint::rep> mNow;
+};
+
+
+export enum class LogLevel : uint8_t
+{
+    Debug,
+    Info,
+    Warning,
+    Error,
+};
+
+// Receives all diagnostics of a scheduler. Called from the scheduler's logging thread only, never
+// from a worker or from inside `ProcessTasks`, so it may block (file/pipe writes) without harm.
+export using LogSink = std::function<void(LogLevel level, std::string_view message)>;
+
+class AsyncLogger // not exported
+{
+public:
+    AsyncLogger(LogSink sink);
+    ~AsyncLogger(); // everything logged so far is still delivered
+
+    // Lock-free and never blocks: formats into a ring buffer slot, or drops the message if the
+    // buffer is full. Levels below TASK_SCHEDULING_MIN_LOG_LEVEL cost nothing at all.
+    template <LogLevel level, typename... Args>
+    void Log(const char* format, Args... args)
+    {
+        if constexpr (static_cast<int>(level) >= TASK_SCHEDULING_MIN_LOG_LEVEL)
+        {
+            Slot* slot = Acquire();
+            if (slot == nullptr) { return; }
+            slot->level = level;
+            if constexpr (sizeof...(Args) == 0) { std::snprintf(slot->text, sizeof(slot->text), "%s", format); }
+            else { std::snprintf(slot->text, sizeof(slot->text), format, args...); }
+            Publish(slot);
+        }
+    }
+
+private:
+    // Bounded multi-producer/single-consumer queue, every slot has a sequence number telling
+    // whether it is free for position `n` (== n) or holds the message of position `n` (== n + 1).
+    static constexpr uint32_t kSlots = 256U;
+    struct Slot
+    {
+        std::atomic_uint64_t sequence {0U};
+        LogLevel level {LogLevel::Info};
+        char text[120] {};
+    };
+    Slot* Acquire();
+    void Publish(Slot* slot);
+    void Drain();
+
+    LogSink mSink;
+    std::unique_ptr<Slot[]> mSlots;
+    std::atomic_uint64_t mHead {0U}; // next position to write
+    uint64_t mTail = 0U;             // next position to read, logging thread only
+    std::atomic_uint64_t mDropped {0U};
+    std::atomic_uint32_t mSignal {0U}; // bumped on publish, the logging thread waits on it
+    std::atomic_bool mStopping {false};
+    std::thread mThread;
+};
+
+
+export struct LatencyStats
+{
+    uint64_t count {0U};
+    std::chrono::nanoseconds p50 {0};
+    std::chrono::nanoseconds p99 {0};
+    std::chrono::nanoseconds p999 {0};
+    std::chrono::nanoseconds max {0};
+};
+
+class LatencyHistogram // not exported
+{
+public:
+    void Record(std::chrono::nanoseconds value);
+    LatencyStats Snapshot() const;
+    // Only what was recorded since the previous call with the same `mark` (which is updated), so
+    // percentiles over a sliding window without ever resetting the counters
+    LatencyStats Since(std::vector<uint64_t>& mark) const;
+
+private:
+    // HDR-style log-linear buckets: every power of two is split into 16 linear sub-buckets, so any
+    // recorded value is off by at most ~6%, from nanoseconds up to centuries, in 976 counters.
+    // Recording is a few relaxed atomic increments, so any thread may record without locking.
+    static constexpr uint32_t kSubBucketBits = 4U;
+    static constexpr uint32_t kSubBuckets = 1U << kSubBucketBits;
+    static constexpr uint32_t kBuckets = (64U - kSubBucketBits + 1U) * kSubBuckets;
+    static uint32_t BucketIndex(uint64_t value);
+    static uint64_t BucketUpperBound(uint32_t index);
+    static LatencyStats Percentiles(const std::array<uint64_t, kBuckets>& buckets, uint64_t count, std::chrono::nanoseconds max);
+
+    std::array<std::atomic_uint64_t, kBuckets> mBuckets {};
+    std::atomic_uint64_t mCount {0U};
+    std::atomic_uint64_t mMax {0U};
+};
+
+
+enum class TraceEventType : uint8_t // not exported
+{
+    Insert,   // `AddTimedTask`
+    Expire,   // `ProcessTasks` noticed that the deadline has passed
+    Dispatch, // handed to the parallel runner
+    Start,    // callback begins
+    End,      // callback returned
+};
+
+struct TraceEvent // not exported
+{
+    TraceEventType type;
+    const char* tag;
+    uint64_t sequence;
+    std::chrono::time_point<std::chrono::steady_clock> time;
+};
+
+class TraceRecorder // not exported
+{
+public:
+    TraceRecorder(uint32_t eventsPerThread);
+    void Record(TraceEventType type, const TimedTaskInfo& task);
+    void DumpChromeTrace(std::ostream& out) const;
+
+private:
+    // Every thread writes into its own ring buffer, so recording never contends with other
+    // threads. The tiny per-ring lock is only ever contested while `DumpChromeTrace` copies it.
+    struct Ring
+    {
+        std::thread::id thread;
+        std::vector<TraceEvent> events; // oldest events are overwritten when full
+        uint64_t written {0U};
+        mutable std::atomic_flag lock;
+    };
+    Ring* GetThreadRing();
+
+    const uint64_t mId; // unique among all recorders, identifies us in the thread-local ring cache
+    const uint32_t mEventsPerThread;
+    mutable std::mutex mRingsMutex;
+    std::vector<std::unique_ptr<Ring>> mRings;
+};
+
+
+export struct WorkerStats
+{
+    uint64_t tasksExecuted {0U};
+    std::chrono::nanoseconds busyTime {0};  // inside task callbacks
+    std::chrono::nanoseconds idleTime {0};  // parked, waiting for work
+    uint64_t wakeups {0U};      // times the worker was woken up after parking
+    uint64_t emptyWakeups {0U}; // ...and found no work (spurious, or another worker was faster)
+};
+
+struct alignas(64) WorkerCounters // not exported
+{
+    // Written by the owning worker only, read by anyone. Padded to a cache line each, so sampling
+    // and the other workers never cause false sharing.
+    std::atomic_uint64_t tasksExecuted {0U};
+    std::atomic_uint64_t busyNanoseconds {0U};
+    std::atomic_uint64_t idleNanoseconds {0U};
+    std::atomic_uint64_t wakeups {0U};
+    std::atomic_uint64_t emptyWakeups {0U};
+};
+
+
+struct QueuedTask // not exported
+{
+    TimedTaskInfo task;
+    std::chrono::time_point<std::chrono::steady_clock> enqueued;
+};
+
+struct PostedTask // not exported
+{
+    std::atomic<PostedTask*> next {nullptr};
+    TimedTaskInfo task;
+};
+
+// Unbounded lock-free multi-producer/single-consumer queue of intrusive nodes (Vyukov), for
+// `TaskScheduler::PostToMain`. Pushing is a single exchange, so it never blocks the poster.
+class PostQueue // not exported
+{
+public:
+    PostQueue() : mHead(&mStub), mTail(&mStub) {}
+    void Push(PostedTask* node);
+    // nullptr if empty, or if a concurrent push is half way done (retry in that case)
+    PostedTask* Pop();
+
+private:
+    std::atomic<PostedTask*> mHead; // producers
+    PostedTask* mTail;              // consumer only
+    PostedTask mStub;
+};
+
+// What happens to a parallel task dispatched while the queue of the parallel threads is full (see
+// `TaskSchedulerInfo::maxParallelQueue`), so overload degrades predictably instead of piling up.
+export enum class OverflowPolicy : uint8_t
+{
+    Block,              // the producer waits for a free slot (parallel threads run it inline instead), dropped on `Terminate`
+    RunInline,          // the producer runs the task itself
+    DropLowestPriority, // the queued task of lowest priority (the oldest of those) or, if lower, the new one is dropped
+    DropOldest,         // the task queued first is dropped
+};
+
+// Which queued parallel task a free thread picks first (resources and strands permitting)
+export enum class QueueOrder : uint8_t
+{
+    Fifo,                  // dispatch order
+    EarliestDeadlineFirst, // by `deadline + completeWithin`, so when saturated the most overdue work runs first
+};
+
+export struct OverflowStats
+{
+    uint64_t blocked {0U};   // producers which had to wait
+    uint64_t ranInline {0U}; // tasks run by their producer
+    uint64_t dropped {0U};   // tasks dropped (never run)
+};
+
 class ParallelTaskRunner // not exported
 {
 public:
-    ParallelTaskRunner(const uint8_t numParallelThreads);
+    ParallelTaskRunner(const uint8_t numParallelThreads, QueueOrder order, uint32_t maxQueue, OverflowPolicy overflowPolicy,
+        const Clock* clock, TraceRecorder* tracer, AsyncLogger* logger);
     ~ParallelTaskRunner();
     void Terminate();
-    void RunTask(const TaskInfo& taskInfo);
+    void RunTask(const TimedTaskInfo& task);
+    void RunTask(TimedTaskInfo&& task);
+    LatencyStats GetQueueDelay() const { return mQueueDelay.Snapshot(); }
+    LatencyStats GetLateness() const { return mLateness.Snapshot(); }
+    LatencyStats GetLatenessSince(std::vector<uint64_t>& mark) const { return mLateness.Since(mark); }
+    std::vector<WorkerStats> GetWorkerStats() const;
+    size_t GetQueueDepth() const { return mQueueDepth.load(std::memory_order_relaxed); }
+    // Until nothing is queued or running, executing queued tasks on the calling thread meanwhile.
+    // Not from inside a parallel task, which would wait for itself.
+    void WaitIdle();
+    void Wait(const TaskGroup& group); // same, until `group` is done
+    void NotifyGroupDone(); // a group was completed outside of the runner
+    // A task which ran or was dropped outside of the runner: completes it for its group (if one-shot,
+    // periodic originals are not counted) and wakes up `Wait` if that was the last. Without `mQueueMutex`.
+    void LeaveGroup(const TaskInfo& taskInfo);
+    uint64_t GetHelpedTasks() const { return mHelpedTasks.load(std::memory_order_relaxed); }
+    OverflowStats GetOverflowStats() const;
+    uint64_t GetStaleTasks() const { return mStaleTasks.load(std::memory_order_relaxed); }
+    // For main-thread tasks declaring resources, blocks until no running task conflicts
+    void AcquireResources(uint64_t reads, uint64_t writes);
+    void ReleaseResources(uint64_t reads, uint64_t writes);
 
 private:
-    void Runner();
+    void Runner(uint8_t index);
+    void Execute(QueuedTask& timedTask); // without `mQueueMutex`
+    void Help(const TaskGroup* group); // nullptr => until idle; strand waiting tasks imply an active one
+    // The rest require `mQueueMutex`
+    QueuedTask Take(size_t index);
+    void Finish(const QueuedTask& timedTask);
+    void Enqueue(QueuedTask&& timedTask); // into `mQueue`, at its place by `mOrder`
+    void HandOffStrand(uint64_t strand); // its task left `mQueue`, the next waiting one takes its place
+    bool Overflow(TimedTaskInfo& task, std::unique_lock<std::mutex>& lock); // false if `task` is done with
+    void Drop(const TimedTaskInfo& task, bool wasQueued); // from `mQueue`, or the new one
+    bool CanStart(uint64_t reads, uint64_t writes) const;
+    void Claim(uint64_t reads, uint64_t writes);
+    bool Unclaim(uint64_t reads, uint64_t writes); // true if anything was released
+    size_t NextRunnable() const; // index into `mQueue`, `mQueue.size()` if nothing may start
     std::condition_variable mCV;
     std::vector<std::thread> mThreads;
     std::atomic_bool mRunning;
-    std::binary_semaphore mSem {1}; // ready!
-    std::queue<TaskInfo> mQueue;
+    // Guards `mQueue`, and is also the mutex `mCV` waits with, so a worker checking for an empty
+    // queue cannot miss the notification of a task pushed right after.
+    std::mutex mQueueMutex;
+    std::deque<QueuedTask> mQueue; // in `mOrder`, but tasks blocked by resources may be overtaken
+    const QueueOrder mOrder;
+    // Strands with a task in `mQueue` or running, and their tasks waiting behind it. Guarded by
+    // `mQueueMutex`, the worker finishing a strand task moves the next one into `mQueue`.
+    std::unordered_map<uint64_t, std::queue<QueuedTask>> mStrands;
+    size_t mStrandWaiting = 0U;
+    std::atomic_size_t mQueueDepth {0U}; // `mQueue` plus strand waiting tasks, readable without locking
+    // Resources of running tasks, see `TaskInfo::reads`. Guarded by `mQueueMutex`.
+    std::array<uint32_t, 64> mReaders {};
+    uint64_t mReadMask = 0U; // bit set while `mReaders` of it is non-zero
+    uint64_t mWriteMask = 0U;
+    // Claim of the main thread waiting in `AcquireResources`, fences off queued tasks like a skipped one
+    uint64_t mPendingReads = 0U;
+    uint64_t mPendingWrites = 0U;
+    size_t mActive = 0U; // taken from `mQueue` and not finished yet, guarded by `mQueueMutex`
+    // Bounded queue, see `OverflowPolicy`. `Block`ed producers wait on `mSpaceCV` (with `mQueueMutex`).
+    const uint32_t mMaxQueue; // 0 => unbounded
+    const OverflowPolicy mOverflowPolicy;
+    std::condition_variable mSpaceCV;
+    uint32_t mBlockedProducers = 0U; // guarded by `mQueueMutex`
+    std::atomic_uint64_t mOverflowBlocked {0U};
+    std::atomic_uint64_t mOverflowRanInline {0U};
+    std::atomic_uint64_t mOverflowDropped {0U};
+    std::atomic_uint64_t mStaleTasks {0U}; // see `TaskInfo::maxStaleness`
+    std::atomic_uint64_t mHelpedTasks {0U}; // run by a thread in `WaitIdle`
+    std::unique_ptr<WorkerCounters[]> mCounters; // one per thread
+    const uint8_t mNumThreads; // `mThreads` is cleared by `Terminate`, the counters stay readable
+    const Clock* mClock; // for lateness, busy/idle times are always measured in real time
+    TraceRecorder* mTracer; // nullptr unless tracing
+    AsyncLogger* mLogger;
+
+    LatencyHistogram mQueueDelay; // from `RunTask` until a worker starts the callback
+    LatencyHistogram mLateness;   // from the deadline until a worker starts the callback
+};
+
+
+// What happens to a task of a priority class affected by load shedding, see `OverloadInfo`
+export enum class OverloadAction : uint8_t
+{
+    Run,   // nothing, as if not affected
+    Defer, // postponed by `OverloadInfo::deferBy`, lateness still counts from the original deadline
+    Shed,  // dropped, i.e. completes its group without running
+};
+
+export struct OverloadReport
+{
+    uint8_t level {0U}; // priority classes affected: 0 => none, 1 => Low, 2 => Low and Normal, 3 => all but Critical
+    uint32_t parallelQueueDepth {0U};
+    std::chrono::nanoseconds mainLatenessP99 {0};     // over the last window
+    std::chrono::nanoseconds parallelLatenessP99 {0}; // over the last window
+    uint64_t shed {0U};      // since the start
+    uint64_t deferrals {0U}; // since the start, a task deferred twice counts twice
+};
+
+// Load shedding, so a frame spike or a server under attack sheds cosmetic work instead of delaying
+// gameplay-critical timers. Every `window` the thresholds are checked: while any is crossed, one
+// more priority class is affected per window (lowest first, never Critical), and once all are met
+// again one less per window. Affected tasks are deferred or shed when they fire, or are posted.
+// Disabled while both thresholds are 0.
+export struct OverloadInfo
+{
+    uint32_t maxParallelQueueDepth {0U};         // 0 => not checked
+    std::chrono::nanoseconds maxLatenessP99 {0}; // of main-thread or parallel tasks, 0 => not checked
+    std::chrono::milliseconds window {100ms};
+    std::array<OverloadAction, 3> actions {OverloadAction::Shed, OverloadAction::Defer, OverloadAction::Defer}; // Low, Normal, High
+    std::chrono::milliseconds deferBy {50ms};
+    // Called whenever the level changes, on the thread calling `ProcessTasks`
+    std::function<void(const OverloadReport& report)> onOverload = nullptr;
+};
+
+class OverloadController // not exported
+{
+public:
+    OverloadController(const OverloadInfo& info, std::chrono::time_point<std::chrono::steady_clock> now);
+    // From the thread calling `ProcessTasks`
+    void Evaluate(std::chrono::time_point<std::chrono::steady_clock> now, const LatencyHistogram& mainLateness, const ParallelTaskRunner* runner);
+    OverloadReport GetReport() const;
+    // What to do with a task firing (or posted) now. Callable from any thread.
+    OverloadAction Admit(TaskPriority priority);
+    std::chrono::nanoseconds GetDeferBy() const { return mDeferBy; }
+
+private:
+    OverloadInfo mInfo;
+    std::chrono::nanoseconds mDeferBy;
+    std::chrono::time_point<std::chrono::steady_clock> mNextEvaluation;
+    std::vector<uint64_t> mMainMark; // see `LatencyHistogram::Since`
+    std::vector<uint64_t> mParallelMark;
+    OverloadReport mReport {};
+    std::atomic_uint8_t mLevel {0U};
+    std::atomic_uint64_t mShed {0U};
+    std::atomic_uint64_t mDeferrals {0U};
+};
+
+export struct TaskSchedulerStats
+{
+    // Main-thread tasks which did not fit into the frame budget, see `ProcessTasks(budget)`.
+    uint32_t deferredTasks {0U};          // carried over to the next frame right now
+    uint32_t peakDeferredTasks {0U};      // high-water mark of `deferredTasks`
+    uint64_t totalDeferrals {0U};         // every frame a task is carried over counts once
+    std::chrono::microseconds maxDeferredLateness {0}; // most overdue task still waiting
+
+    // Last call to `ProcessTasks`
+    uint32_t lastFrameExecutedTasks {0U}; // main-thread callbacks run
+    std::chrono::microseconds lastFrameExecutionTime {0}; // time spent inside those callbacks
+
+    // How late tasks fire, i.e. callback start minus deadline. For the parallel lane the total is
+    // split into the time until `ProcessTasks` noticed the deadline (tick granularity) and the
+    // time spent waiting in the queue of the parallel runner.
+    LatencyStats mainLateness;
+    LatencyStats parallelLateness;
+    LatencyStats parallelDispatchLateness;
+    LatencyStats parallelQueueDelay;
+    uint64_t parallelHelpedTasks {0U}; // parallel tasks run by the thread in `WaitIdle`/`Terminate(true)`
+    OverflowStats parallelOverflow; // see `TaskSchedulerInfo::maxParallelQueue`
+    uint64_t parallelStaleTasks {0U}; // bodies not run because of `TaskInfo::maxStaleness`
+
+    // Stalls, i.e. frames longer than the previous one by more than `TaskSchedulerInfo::maxCatchUp`
+    // while tasks were overdue
+    uint32_t stalls {0U};
+    std::chrono::microseconds lastStall {0}; // how far the last stall exceeded `maxCatchUp`
+    std::chrono::microseconds catchUpDebt {0}; // scheduler time still behind the clock (Clamp/Spread)
+    uint64_t skippedPeriodic {0U}; // periodic occurrences dropped by `SkipMissedPeriodic`
+
+    OverloadReport overload; // see `TaskSchedulerInfo::overload`
 };
 
 
+// What happens to the backlog after a stall (debugger, loading screen, VM pause, ...), i.e. when
+// `ProcessTasks` is called `TaskSchedulerInfo::maxCatchUp` later than the frame time so far, with
+// tasks overdue meanwhile. A low frame rate is no stall, neither is sleeping in `WaitForNextDeadline`.
+export enum class CatchUpPolicy
+{
+    FireAll,            // everything due fires right away, including every missed periodic occurrence
+    Clamp,              // time advances by at most `maxCatchUp`, the rest of the stall is skipped
+    SkipMissedPeriodic, // like FireAll, but periodic tasks fire once and drop the missed occurrences
+    Spread,             // like Clamp, but the skipped time is caught up over `catchUpFrames` frames
+};
+
+// Owns the deadlines of parallel tasks when `TaskSchedulerInfo::parallelTimerThread` is set, and
+// hands them to the runner right at their deadline instead of at the next `ProcessTasks`.
+class ParallelTimer // not exported
+{
+public:
+    ParallelTimer(uint16_t maxSize, CatchUpPolicy policy, const Clock* clock, const std::atomic<std::chrono::nanoseconds::rep>* offset,
+        ParallelTaskRunner* runner, OverloadController* overload, LatencyHistogram* dispatchLateness, TraceRecorder* tracer, AsyncLogger* logger);
+    ~ParallelTimer();
+    void Insert(TimedTaskInfo&& task);
+    void Terminate(bool dispatchPending); // pending tasks are dispatched or dropped
+    uint64_t GetSkippedPeriodic() const { return mSkippedPeriodic.load(std::memory_order_relaxed); }
+
+private:
+    void Run();
+    std::chrono::time_point<std::chrono::steady_clock> Now() const; // scheduler time
+
+    std::mutex mMutex; // guards `mHeap` and `mStopping`, `mCV` waits with it
+    std::condition_variable mCV;
+    std::vector<TimedTaskInfo> mHeap; // heap, earliest (see `FiresBefore`) at the front
+    std::chrono::time_point<std::chrono::steady_clock> mNextWakeUp = std::chrono::time_point<std::chrono::steady_clock>::max(); // earliest deadline + slack
+    bool mStopping = false;
+    std::thread mThread;
+
+    const uint16_t mMaxSize;
+    const CatchUpPolicy mCatchUpPolicy;
+    const Clock* mClock;
+    const std::atomic<std::chrono::nanoseconds::rep>* mOffset; // clock minus scheduler time
+    ParallelTaskRunner* mRunner;
+    OverloadController* mOverload; // nullptr unless load shedding
+    LatencyHistogram* mDispatchLateness;
+    TraceRecorder* mTracer;
+    AsyncLogger* mLogger;
+    std::atomic_uint64_t mSkippedPeriodic {0U};
+};
+
 export struct TaskSchedulerInfo // Yes, I'm a Vulkan programmer ^^
 {
     uint16_t maxSize {64};
     uint8_t numParallelThreads {1U};
+    bool enableTracing {false}; // record task events for `TaskScheduler::DumpTrace`
+    uint32_t traceEventsPerThread {16384U}; // ring buffer size, the oldest events are overwritten
+    LogSink logSink = nullptr; // nullptr => warnings/errors to std::cerr, the rest to std::cout
+    Clock* clock = nullptr; // nullptr => `SteadyClock`. Not owned, must outlive the scheduler.
+    // Non-zero enables fixed-timestep mode: time only moves through `ProcessTasks(ticks)`, by this
+    // much per tick, and `clock` is ignored.
+    std::chrono::nanoseconds fixedTimestep {0};
+    CatchUpPolicy catchUpPolicy {CatchUpPolicy::FireAll};
+    std::chrono::microseconds maxCatchUp {100ms};
+    uint32_t catchUpFrames {8U}; // `CatchUpPolicy::Spread` only
+    // Parallel tasks are timed by an extra thread and dispatched right at their deadline, instead of
+    // by `ProcessTasks`, which then only handles main-thread tasks. Not with `clock` or `fixedTimestep`,
+    // as the thread waits in real time.
+    bool parallelTimerThread {false};
+    QueueOrder parallelQueueOrder {QueueOrder::Fifo};
+    // Non-zero bounds the queue of the parallel threads (strand waiting tasks included) to this
+    // many tasks, and `overflowPolicy` decides what happens to the ones beyond.
+    uint32_t maxParallelQueue {0U};
+    OverflowPolicy overflowPolicy {OverflowPolicy::Block};
+    OverloadInfo overload;
 };
 
 export class TaskScheduler
@@ -121,91 +869,736 @@ public:
     TaskScheduler(const TaskSchedulerInfo& info);
     ~TaskScheduler();
     void ProcessTasks();
+    // Only runs main-thread tasks until `budget` is used up, the rest are carried over to the
+    // next frame (most overdue first). At least one due task is always run, so nothing starves.
+    void ProcessTasks(std::chrono::microseconds budget);
+    // Fixed-timestep mode only (see `TaskSchedulerInfo::fixedTimestep`): advances the scheduler by
+    // `ticks` steps, processing each step in turn, independent of wall time. Due tasks fire strictly
+    // by (deadline, insertion order), so lockstep peers and replays see the same sequence.
+    void ProcessTasks(uint32_t ticks);
+    void AddTickTask(uint32_t ticks, const TaskInfo& taskInfo); // fixed-timestep mode only
+    void AddTickTask(uint32_t ticks, TaskInfo&& taskInfo);
+    uint64_t GetTick() const { return mTick; }
+    // Stores a closure bigger than `TaskCallback::kInlineSize` in this scheduler's pool (slabs of
+    // `maxSize` blocks) instead of the shared one. The callback and its copies must not outlive the scheduler.
+    template <typename F>
+    TaskCallback MakeCallback(F&& function)
+    {
+        return TaskCallback(*mCallbackPool, std::forward<F>(function));
+    }
     // In my IDE templates on std::chrono::duration does not work across a module boundary!
+    // So the common units get their own overload, and deadlines are kept at clock resolution
+    // (nanoseconds on most platforms), so sub-millisecond delays like 250us are honored.
+    void AddTimedTask(std::chrono::nanoseconds duration, const TaskInfo& taskInfo);
+    void AddTimedTask(std::chrono::microseconds duration, const TaskInfo& taskInfo);
     void AddTimedTask(std::chrono::milliseconds duration, const TaskInfo& taskInfo);
     void AddTimedTask(std::chrono::seconds duration, const TaskInfo& taskInfo);
+    // Same, but the task is moved instead of copied all the way to the lane which runs it
+    void AddTimedTask(std::chrono::nanoseconds duration, TaskInfo&& taskInfo);
+    void AddTimedTask(std::chrono::microseconds duration, TaskInfo&& taskInfo);
+    void AddTimedTask(std::chrono::milliseconds duration, TaskInfo&& taskInfo);
+    void AddTimedTask(std::chrono::seconds duration, TaskInfo&& taskInfo);
+    // Any other unit (minutes, custom periods, floating point, ...). Compilers which handle templates
+    // across the module boundary pick this instead of complaining about ambiguous overloads.
+    template <typename Rep, typename Period>
+    void AddTimedTask(std::chrono::duration<Rep, Period> duration, const TaskInfo& taskInfo)
+    {
+        AddTimedTask(std::chrono::duration_cast<std::chrono::nanoseconds>(duration), taskInfo);
+    }
+    template <typename Rep, typename Period>
+    void AddTimedTask(std::chrono::duration<Rep, Period> duration, TaskInfo&& taskInfo)
+    {
+        AddTimedTask(std::chrono::duration_cast<std::chrono::nanoseconds>(duration), std::move(taskInfo));
+    }
+    // Run as soon as possible, bypassing the timers: `Post` pushes straight into the queue of the
+    // parallel threads (or to the main thread without any), `PostToMain` into a lock-free queue which
+    // the next `ProcessTasks` runs together with the expired main-thread tasks, and which wakes up
+    // `WaitForNextDeadline`/`GetPollFd`. Callable from any thread. `forceSynchronous` and `period`
+    // are ignored.
+    void Post(const TaskInfo& taskInfo);
+    void Post(TaskInfo&& taskInfo);
+    void PostToMain(const TaskInfo& taskInfo);
+    void PostToMain(TaskInfo&& taskInfo);
+    // Builds the callback from `function` and `args` (bound like std::bind, but moved instead of
+    // copied) right inside the task, in this scheduler's pool (see `MakeCallback`). From there the
+    // task is only moved: into the container, and into the parallel queue or the main-thread list.
+    template <typename F, typename... Args>
+    void EmplaceTimedTask(std::chrono::nanoseconds delay, TaskLane lane, F&& function, Args&&... args)
+    {
+        if constexpr (sizeof...(Args) == 0)
+        {
+            AddTimedTask(delay, TaskInfo { TaskCallback(*mCallbackPool, std::forward<F>(function)), lane == TaskLane::Main });
+        }
+        else
+        {
+            AddTimedTask(delay, TaskInfo { TaskCallback(*mCallbackPool,
+                [function = std::forward<F>(function), ...args = std::forward<Args>(args)]() mutable {
+                    std::invoke(function, args...);
+                }), lane == TaskLane::Main });
+        }
+    }
     void Terminate(bool finishTasks = false);
+    // Call from the thread calling `ProcessTasks`
+    TaskSchedulerStats GetStats() const;
+    // Per parallel thread counters and the number of tasks waiting for a free thread. Cheap
+    // (relaxed atomic loads), callable from any thread.
+    std::vector<WorkerStats> GetWorkerStats() const;
+    size_t GetParallelQueueDepth() const;
+    // Writes the recorded events (see `TaskSchedulerInfo::enableTracing`) as Chrome trace JSON,
+    // which can be opened in chrome://tracing or https://ui.perfetto.dev. Callable from any thread.
+    void DumpTrace(std::ostream& out) const;
+    // End-of-frame sync point: returns once all dispatched parallel tasks have finished. Instead of
+    // blocking, the calling thread runs queued ones itself. Timers not due yet are not waited for.
+    // Not from inside a parallel task, nor a main-thread task declaring resources.
+    void WaitIdle();
+    // Fork-join: same as `WaitIdle`, but only until the tasks of `group` are done. Tasks which are
+    // not dispatched by the time of the call (main-thread ones, or ones not due yet without
+    // `parallelTimerThread`) only progress in `ProcessTasks`: poll `TaskGroup::IsDone` for those.
+    void Wait(const TaskGroup& group);
+
+    // For hosts without a frame loop. Sleeps until the earliest pending deadline, or until another
+    // thread adds a task which is due even earlier. Returns false if `stopToken` was triggered.
+    // Must be called from the thread calling `ProcessTasks`.
+    bool WaitForNextDeadline(std::stop_token stopToken = {});
+    // Calls `ProcessTasks` whenever a deadline is reached, until `stopToken` is triggered.
+    void RunUntil(std::stop_token stopToken);
+
+#if defined(__linux__)
+    // For hosts with an event loop (epoll, io_uring, ...). The returned file descriptor becomes
+    // readable (EPOLLIN) whenever `ProcessTasks` should be called: a deadline is reached or another
+    // thread added an earlier task. Created on first call and owned by the scheduler.
+    int GetPollFd();
+#endif
 
 private:
     bool mRunning;
     bool mParallelExecutionAllowed;
     bool ForEachTask(TimedTaskInfo& timedTaskInfo);
-    bool ForceRunEachTask(const TimedTaskInfo& timedTaskInfo);
+    bool ForceRunEachTask(TimedTaskInfo& timedTaskInfo);
+    void RunDeferredTasks(std::chrono::microseconds budget);
+    void RunOnMainThread(const TimedTaskInfo& timedTaskInfo);
+    void LeaveGroup(const TaskInfo& taskInfo); // ran on the main thread, or dropped before reaching the runner
+    void InsertTimedTask(std::chrono::time_point<std::chrono::steady_clock> deadline, TaskInfo&& taskInfo,
+        std::chrono::time_point<std::chrono::steady_clock> notBefore = {});
+    void DrainInbox();
+    void DrainPosted();
+    void CatchUp();
+    // Scheduler time: the clock minus the part of stalls skipped by `CatchUpPolicy::Clamp/Spread`.
+    // All deadlines are in scheduler time. Callable from any thread.
+    std::chrono::time_point<std::chrono::steady_clock> Now() const;
+#if defined(__linux__)
+    void ArmPollFd();
+#endif
     ParallelTaskRunner* mParallelRunner = nullptr;
+    ParallelTimer* mParallelTimer = nullptr; // nullptr unless `parallelTimerThread`
     TaskContainer* mContainer = nullptr;
+    CallbackPool* mCallbackPool = nullptr; // for `MakeCallback`
+
+    // Expired main-thread tasks. They are collected during iteration and executed afterwards, so
+    // that they can be run in deadline order and within a frame budget.
+    std::vector<TimedTaskInfo> mDeferred;
+    std::vector<TimedTaskInfo> mExpiredParallel; // sorted and dispatched after iteration
+    TaskSchedulerStats mStats {};
+    LatencyHistogram mMainLateness;
+    LatencyHistogram mDispatchLateness;
+    TraceRecorder* mTracer = nullptr;
+    AsyncLogger* mLogger = nullptr;
+    OverloadController* mOverload = nullptr; // nullptr unless `TaskSchedulerInfo::overload` has a threshold
+    std::atomic_uint64_t mNextSequence {0U};
 
+    // `PostToMain` tasks, in nodes from `mCallbackPool`. `mPostedCount` counts pushed but not yet
+    // drained nodes, the poster seeing it go from 0 to 1 is the one to wake up the waiting host.
+    PostQueue mPosted;
+    std::atomic_uint64_t mPostedCount {0U};
+
+    // `AddTimedTask` may be called from any thread (also from inside a task callback), so new tasks
+    // are put into `mInbox` and moved into `mContainer` by the thread calling `ProcessTasks`.
+    std::mutex mInboxMutex;
+    std::vector<TimedTaskInfo> mInbox;
+    std::vector<TimedTaskInfo> mInboxSwap; // swapped with `mInbox`, so no allocations when draining
+    std::condition_variable_any mWakeCV;
+    // Earliest `deadline + slack` of all pending tasks, i.e. when we must wake up next
+    std::chrono::time_point<std::chrono::steady_clock> mNextDeadline; // guarded by `mInboxMutex`
+    std::chrono::time_point<std::chrono::steady_clock> mIterationNextDeadline; // found by `ForEachTask`
+
+    Clock* mClock = nullptr;
     std::chrono::time_point<std::chrono::steady_clock> mTimer;
-    std::chrono::milliseconds mElapsed;
+
+    // fixed-timestep mode
+    ManualClock* mFixedClock = nullptr; // owned, also in `mClock`
+    std::chrono::nanoseconds mFixedTimestep {0};
+    uint64_t mTick = 0U;
+
+    // catch-up after stalls, see `CatchUpPolicy`
+    CatchUpPolicy mCatchUpPolicy;
+    std::chrono::nanoseconds mMaxCatchUp;
+    uint32_t mCatchUpFrames;
+    std::atomic<std::chrono::nanoseconds::rep> mCatchUpOffset {0}; // clock minus scheduler time, only written by `ProcessTasks`
+    std::chrono::nanoseconds mCatchUpStep {0}; // paid back per frame by `Spread`
+    // Clock time of the last `ProcessTasks`, or of `WaitForNextDeadline` waking up for the next one
+    std::chrono::time_point<std::chrono::steady_clock> mLastProcessed = std::chrono::time_point<std::chrono::steady_clock>::min();
+    std::chrono::nanoseconds mFrameTime {-1}; // between the last two `ProcessTasks`, negative until known
+
+#if defined(__linux__)
+    // `mPollFd` is an epoll instance watching `mTimerFd` (armed to the next deadline) and
+    // `mEventFd` (signaled by `InsertTimedTask`). Guarded by `mInboxMutex`, -1 until requested.
+    // Created by `GetPollFd` on any thread, so `ProcessTasks` reads them under the lock as well.
+    int mPollFd = -1;
+    int mTimerFd = -1;
+    int mEventFd = -1;
+#endif
 };
 
 
 module :private;
 
 
-TaskContainer::TaskContainer(uint16_t size) : mSize(size)
+std::atomic_uint64_t gNextCallbackPoolId {1U};
+
+// Pools by id, so an exiting thread flushes its caches only into pools which still exist. Never
+// destroyed, like `DefaultCallbackPool`, threads and static schedulers may outlive any static.
+struct LiveCallbackPools
 {
-    mList = new ContainerItem[mSize];
-    mFreeList = new uint16_t[mSize];
-    mRemovals = new uint16_t[mSize];
+    std::mutex mutex;
+    std::unordered_map<uint64_t, CallbackPool*> pools;
+};
+LiveCallbackPools& GetLiveCallbackPools()
+{
+    static LiveCallbackPools* live = new LiveCallbackPools();
+    return *live;
+}
 
-    for (uint16_t i = 0; i < mSize; i++)
+struct ThreadPoolCacheEntry
+{
+    uint64_t poolId {0U};
+    void* cache {nullptr};
+};
+// A thread typically frees into the shared pool and the pool of one scheduler, so keep a few
+thread_local std::array<ThreadPoolCacheEntry, 4> tThreadPoolCaches;
+thread_local uint32_t tThreadPoolCacheNext = 0U;
+
+// Hands the caches of an exiting thread back to their pools, or its blocks would be stuck until
+// the pool dies (e.g. short-lived threads posting tasks)
+struct ThreadPoolCacheFlusher
+{
+    std::vector<uint64_t> poolIds; // pools with a cache of this thread
+    ~ThreadPoolCacheFlusher();
+};
+thread_local ThreadPoolCacheFlusher tThreadPoolCacheFlusher;
+thread_local bool tThreadPoolCachesFlushed = false; // blocks freed after that stay in a new cache
+
+ThreadPoolCacheFlusher::~ThreadPoolCacheFlusher()
+{
+    tThreadPoolCachesFlushed = true;
+    tThreadPoolCaches = {};
+    LiveCallbackPools& live = GetLiveCallbackPools();
+    std::lock_guard lock(live.mutex);
+    for (const uint64_t poolId : poolIds)
     {
-        mFreeList[i] = i; // initially full free-list, so must contain all indices
+        const auto it = live.pools.find(poolId);
+        if (it != live.pools.end()) { it->second->FlushThreadCache(); }
     }
-    mFreeCount = mSize;
-    mRemovalCount = 0U;
-    mRemovals[0] = 0; // IDE complains if not initialized, but really doesn't matter.
 }
 
-TaskContainer::~TaskContainer()
+CallbackPool::CallbackPool(uint32_t blocksPerSlab)
+    : mId(gNextCallbackPoolId.fetch_add(1U)), mBlocksPerSlab(std::max(blocksPerSlab, 1U))
 {
-    // Sometimes RAII is a really nice pattern!
-    delete[] mList;
-    delete[] mFreeList;
-    delete[] mRemovals;
-    mFreeCount = 0; // insertion will fail
-    mAllocated.clear(); // ForEach will have 0 iterations
-    mRemovalCount = 0U; // PostIterate will have 0 iterations
+    LiveCallbackPools& live = GetLiveCallbackPools();
+    std::lock_guard lock(live.mutex);
+    live.pools.emplace(mId, this);
 }
 
-bool TaskContainer::Insert(const TimedTaskInfo& elem)
+CallbackPool::~CallbackPool()
 {
-    if (mFreeCount == 0) { return false; }
-    const uint16_t index = mFreeList[--mFreeCount];
-    mList[index] = elem; // insert at back
-    mAllocated.insert(index);
-    return true;
+    // Slabs and caches die with the pool, all callbacks must have been released by now
+    LiveCallbackPools& live = GetLiveCallbackPools();
+    std::lock_guard lock(live.mutex);
+    live.pools.erase(mId);
 }
 
-void TaskContainer::ForEach(const std::function<bool(TimedTaskInfo&)>& iterate)
+CallbackPool::ThreadCache& CallbackPool::GetThreadCache()
 {
-    for (const uint16_t index : mAllocated)
+    for (const ThreadPoolCacheEntry& entry : tThreadPoolCaches)
     {
-        TimedTaskInfo& elem = mList[index].element;
-        if (iterate(elem))
-        {
-            mRemovals[mRemovalCount++] = index;
-        }
+        if (entry.poolId == mId) { return *static_cast<ThreadCache*>(entry.cache); }
     }
-}
 
-void TaskContainer::PostIterate()
-{
-    for (uint16_t i = 0; i < mRemovalCount; i++)
+    // First use by this thread (or evicted by other pools)
+    std::lock_guard lock(mMutex);
+    ThreadCache* cache = nullptr;
+    for (const auto& c : mCaches)
     {
-        mAllocated.erase(mRemovals[i]);
-        mFreeList[mFreeCount++] = mRemovals[i];
+        if (c->thread == std::this_thread::get_id()) { cache = c.get(); }
     }
-    mRemovalCount = 0U;
+    if (cache == nullptr)
+    {
+        mCaches.push_back(std::make_unique<ThreadCache>());
+        cache = mCaches.back().get();
+        cache->thread = std::this_thread::get_id();
+        if (!tThreadPoolCachesFlushed) { tThreadPoolCacheFlusher.poolIds.push_back(mId); }
+    }
+    tThreadPoolCaches[tThreadPoolCacheNext++ % tThreadPoolCaches.size()] = { mId, cache };
+    return *cache;
 }
 
-
-ParallelTaskRunner::ParallelTaskRunner(const uint8_t numParallelThreads)
+void* CallbackPool::Allocate(size_t size)
 {
-    mRunning.store(true);
-    for (uint8_t i = 0; i < numParallelThreads; i++)
+    uint32_t sizeClass = 0U;
+    while (sizeClass < kNumSizeClasses && BlockSize(sizeClass) < size + sizeof(Header)) { sizeClass++; }
+    if (sizeClass == kOversized)
     {
-        mThreads.emplace_back([this]{ this->Runner(); });
+        Header* header = static_cast<Header*>(::operator new(size + sizeof(Header)));
+        *header = { this, kOversized };
+        return header + 1;
+    }
+
+    ThreadCache& cache = GetThreadCache();
+    if (cache.blocks[sizeClass] == nullptr)
+    {
+        // Refill half a cache from the central list, carving a new slab if that is empty too
+        std::lock_guard lock(mMutex);
+        if (mCentral[sizeClass] == nullptr)
+        {
+            const size_t blockSize = BlockSize(sizeClass);
+            const size_t slabSize = blockSize * mBlocksPerSlab;
+            mSlabs.push_back(std::make_unique<std::max_align_t[]>(slabSize / sizeof(std::max_align_t)));
+            std::byte* slab = reinterpret_cast<std::byte*>(mSlabs.back().get());
+            for (size_t offset = slabSize; offset > 0U; offset -= blockSize)
+            {
+                FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + offset - blockSize);
+                block->next = mCentral[sizeClass];
+                mCentral[sizeClass] = block;
+            }
+        }
+        while (mCentral[sizeClass] != nullptr && cache.counts[sizeClass] < kMaxCached / 2U)
+        {
+            FreeBlock* block = mCentral[sizeClass];
+            mCentral[sizeClass] = block->next;
+            block->next = cache.blocks[sizeClass];
+            cache.blocks[sizeClass] = block;
+            cache.counts[sizeClass]++;
+        }
+    }
+
+    FreeBlock* block = cache.blocks[sizeClass];
+    cache.blocks[sizeClass] = block->next;
+    cache.counts[sizeClass]--;
+    Header* header = reinterpret_cast<Header*>(block);
+    *header = { this, sizeClass };
+    return header + 1;
+}
+
+void CallbackPool::Free(void* block)
+{
+    Header* header = static_cast<Header*>(block) - 1;
+    if (header->sizeClass == kOversized)
+    {
+        ::operator delete(header);
+        return;
+    }
+    header->pool->Release(header);
+}
+
+CallbackPool* CallbackPool::Owner(const void* block)
+{
+    return (static_cast<const Header*>(block) - 1)->pool;
+}
+
+void CallbackPool::Release(Header* header)
+{
+    const uint32_t sizeClass = header->sizeClass;
+    ThreadCache& cache = GetThreadCache();
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(header);
+    block->next = cache.blocks[sizeClass];
+    cache.blocks[sizeClass] = block;
+    if (++cache.counts[sizeClass] < kMaxCached) { return; }
+
+    // Threads which only free (workers) would hoard blocks, so hand half back
+    std::lock_guard lock(mMutex);
+    while (cache.counts[sizeClass] > kMaxCached / 2U)
+    {
+        block = cache.blocks[sizeClass];
+        cache.blocks[sizeClass] = block->next;
+        cache.counts[sizeClass]--;
+        block->next = mCentral[sizeClass];
+        mCentral[sizeClass] = block;
+    }
+}
+
+void CallbackPool::FlushThreadCache()
+{
+    std::lock_guard lock(mMutex);
+    const auto it = std::find_if(mCaches.begin(), mCaches.end(),
+        [](const std::unique_ptr<ThreadCache>& c) { return c->thread == std::this_thread::get_id(); });
+    if (it == mCaches.end()) { return; }
+    ThreadCache& cache = **it;
+    for (uint32_t sizeClass = 0U; sizeClass < kNumSizeClasses; sizeClass++)
+    {
+        while (cache.blocks[sizeClass] != nullptr)
+        {
+            FreeBlock* block = cache.blocks[sizeClass];
+            cache.blocks[sizeClass] = block->next;
+            block->next = mCentral[sizeClass];
+            mCentral[sizeClass] = block;
+        }
+    }
+    mCaches.erase(it); // a later thread with the same id starts with a new one
+}
+
+CallbackPool& DefaultCallbackPool()
+{
+    static CallbackPool* pool = new CallbackPool(64U);
+    return *pool;
+}
+
+
+TaskContainer::TaskContainer(uint16_t size) : mSize(size)
+{
+    mList = new ContainerItem[mSize];
+    mFreeList = new uint16_t[mSize];
+    mRemovals = new uint16_t[mSize];
+    mAllocated = new uint16_t[mSize];
+    mPositions = new uint16_t[mSize];
+    mAllocatedCount = 0U;
+
+    for (uint16_t i = 0; i < mSize; i++)
+    {
+        mFreeList[i] = i; // initially full free-list, so must contain all indices
+    }
+    mFreeCount = mSize;
+    mRemovalCount = 0U;
+    mRemovals[0] = 0; // IDE complains if not initialized, but really doesn't matter.
+}
+
+TaskContainer::~TaskContainer()
+{
+    // Sometimes RAII is a really nice pattern!
+    delete[] mList;
+    delete[] mFreeList;
+    delete[] mRemovals;
+    delete[] mAllocated;
+    delete[] mPositions;
+    mFreeCount = 0; // insertion will fail
+    mAllocatedCount = 0U; // ForEach will have 0 iterations
+    mRemovalCount = 0U; // PostIterate will have 0 iterations
+}
+
+bool TaskContainer::Insert(const TimedTaskInfo& elem)
+{
+    return Insert(TimedTaskInfo(elem));
+}
+
+bool TaskContainer::Insert(TimedTaskInfo&& elem)
+{
+    if (mFreeCount == 0) { return false; }
+    const uint16_t index = mFreeList[--mFreeCount];
+    mList[index] = std::move(elem); // insert at back
+    mPositions[index] = mAllocatedCount;
+    mAllocated[mAllocatedCount++] = index;
+    return true;
+}
+
+void TaskContainer::ForEach(const std::function<bool(TimedTaskInfo&)>& iterate)
+{
+    for (uint16_t i = 0; i < mAllocatedCount; i++)
+    {
+        const uint16_t index = mAllocated[i];
+        TimedTaskInfo& elem = mList[index].element;
+        if (iterate(elem))
+        {
+            mRemovals[mRemovalCount++] = index;
+        }
+    }
+}
+
+void TaskContainer::PostIterate()
+{
+    for (uint16_t i = 0; i < mRemovalCount; i++)
+    {
+        const uint16_t index = mRemovals[i];
+        const uint16_t last = mAllocated[--mAllocatedCount];
+        mAllocated[mPositions[index]] = last;
+        mPositions[last] = mPositions[index];
+        mList[index].element = {}; // release whatever the callback captured right away
+        mFreeList[mFreeCount++] = index;
+    }
+    mRemovalCount = 0U;
+}
+
+
+uint32_t LatencyHistogram::BucketIndex(uint64_t value)
+{
+    if (value < kSubBuckets) { return static_cast<uint32_t>(value); }
+    const uint32_t shift = static_cast<uint32_t>(std::bit_width(value)) - 1U - kSubBucketBits;
+    return (shift + 1U) * kSubBuckets + static_cast<uint32_t>(value >> shift) - kSubBuckets;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(uint32_t index)
+{
+    if (index < kSubBuckets) { return index; }
+    const uint32_t shift = index / kSubBuckets - 1U;
+    const uint64_t lowest = static_cast<uint64_t>(kSubBuckets + index % kSubBuckets) << shift;
+    return lowest + ((uint64_t{1} << shift) - 1U);
+}
+
+void LatencyHistogram::Record(std::chrono::nanoseconds value)
+{
+    const uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(value.count(), 0));
+    mBuckets[BucketIndex(ns)].fetch_add(1U, std::memory_order_relaxed);
+    mCount.fetch_add(1U, std::memory_order_relaxed);
+
+    uint64_t max = mMax.load(std::memory_order_relaxed);
+    while (ns > max && !mMax.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+LatencyStats LatencyHistogram::Snapshot() const
+{
+    // Not an atomic snapshot, counters may move while we read them. Good enough for statistics.
+    std::array<uint64_t, kBuckets> buckets;
+    for (uint32_t i = 0; i < kBuckets; i++) { buckets[i] = mBuckets[i].load(std::memory_order_relaxed); }
+    return Percentiles(buckets, mCount.load(std::memory_order_relaxed), std::chrono::nanoseconds(mMax.load(std::memory_order_relaxed)));
+}
+
+LatencyStats LatencyHistogram::Since(std::vector<uint64_t>& mark) const
+{
+    mark.resize(kBuckets, 0U);
+    std::array<uint64_t, kBuckets> buckets;
+    uint64_t count = 0U;
+    uint32_t highest = 0U;
+    for (uint32_t i = 0; i < kBuckets; i++)
+    {
+        const uint64_t total = mBuckets[i].load(std::memory_order_relaxed);
+        buckets[i] = total - mark[i];
+        mark[i] = total;
+        count += buckets[i];
+        if (buckets[i] != 0U) { highest = i; }
+    }
+    return Percentiles(buckets, count, std::chrono::nanoseconds(BucketUpperBound(highest))); // no exact max per window
+}
+
+LatencyStats LatencyHistogram::Percentiles(const std::array<uint64_t, kBuckets>& buckets, uint64_t count, std::chrono::nanoseconds max)
+{
+    LatencyStats stats {};
+    stats.count = count;
+    stats.max = max;
+    if (stats.count == 0U) { return stats; }
+
+    const uint64_t p50 = (stats.count * 500U + 999U) / 1000U; // rank, rounded up
+    const uint64_t p99 = (stats.count * 990U + 999U) / 1000U;
+    const uint64_t p999 = (stats.count * 999U + 999U) / 1000U;
+    uint64_t cumulative = 0U;
+    for (uint32_t i = 0; i < kBuckets && cumulative < p999; i++)
+    {
+        const uint64_t bucket = buckets[i];
+        if (bucket == 0U) { continue; }
+        const uint64_t before = cumulative;
+        cumulative += bucket;
+        const auto value = std::min(std::chrono::nanoseconds(BucketUpperBound(i)), stats.max);
+        if (before < p50 && cumulative >= p50) { stats.p50 = value; }
+        if (before < p99 && cumulative >= p99) { stats.p99 = value; }
+        if (cumulative >= p999) { stats.p999 = value; }
+    }
+    return stats;
+}
+
+
+SteadyClock gSteadyClock; // default for schedulers without `TaskSchedulerInfo::clock`
+
+AsyncLogger::AsyncLogger(LogSink sink) : mSink(std::move(sink))
+{
+    if (mSink == nullptr)
+    {
+        mSink = [](LogLevel level, std::string_view message) {
+            (level >= LogLevel::Warning ? std::cerr : std::cout) << message << "\n";
+        };
+    }
+    mSlots = std::make_unique<Slot[]>(kSlots);
+    for (uint32_t i = 0; i < kSlots; i++) { mSlots[i].sequence.store(i, std::memory_order_relaxed); }
+    mThread = std::thread([this] { Drain(); });
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    mStopping.store(true);
+    mSignal.fetch_add(1U, std::memory_order_release);
+    mSignal.notify_one();
+    mThread.join();
+}
+
+AsyncLogger::Slot* AsyncLogger::Acquire()
+{
+    uint64_t position = mHead.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Slot* slot = &mSlots[position % kSlots];
+        const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == position)
+        {
+            if (mHead.compare_exchange_weak(position, position + 1U, std::memory_order_relaxed)) { return slot; }
+        }
+        else if (sequence < position)
+        {
+            mDropped.fetch_add(1U, std::memory_order_relaxed); // full, logging thread is behind
+            return nullptr;
+        }
+        else
+        {
+            position = mHead.load(std::memory_order_relaxed); // another producer took it
+        }
+    }
+}
+
+void AsyncLogger::Publish(Slot* slot)
+{
+    slot->sequence.store(slot->sequence.load(std::memory_order_relaxed) + 1U, std::memory_order_release);
+    mSignal.fetch_add(1U, std::memory_order_release);
+    mSignal.notify_one();
+}
+
+void AsyncLogger::Drain()
+{
+    uint64_t reportedDropped = 0U;
+    while (true)
+    {
+        const uint32_t signal = mSignal.load(std::memory_order_acquire);
+        Slot* slot = &mSlots[mTail % kSlots];
+        if (slot->sequence.load(std::memory_order_acquire) == mTail + 1U)
+        {
+            mSink(slot->level, slot->text);
+            slot->sequence.store(mTail + kSlots, std::memory_order_release); // free for the next round
+            mTail++;
+            continue;
+        }
+
+        const uint64_t dropped = mDropped.load(std::memory_order_relaxed);
+        if (dropped != reportedDropped)
+        {
+            char text[64];
+            std::snprintf(text, sizeof(text), "[AsyncLogger] %llu messages dropped!", static_cast<unsigned long long>(dropped - reportedDropped));
+            mSink(LogLevel::Warning, text);
+            reportedDropped = dropped;
+        }
+        if (mStopping.load()) { return; }
+        mSignal.wait(signal, std::memory_order_acquire); // returns right away if anything was published since
+    }
+}
+
+
+std::atomic_uint64_t gNextTraceRecorderId {1U};
+
+struct ThreadTraceCache
+{
+    uint64_t recorderId {0U};
+    void* ring {nullptr};
+};
+thread_local ThreadTraceCache tThreadTraceCache;
+
+TraceRecorder::TraceRecorder(uint32_t eventsPerThread)
+    : mId(gNextTraceRecorderId.fetch_add(1U)), mEventsPerThread(std::max(eventsPerThread, 1U))
+{
+}
+
+TraceRecorder::Ring* TraceRecorder::GetThreadRing()
+{
+    if (tThreadTraceCache.recorderId == mId)
+    {
+        return static_cast<Ring*>(tThreadTraceCache.ring);
+    }
+
+    // First event of this thread (or the thread switched between schedulers)
+    std::lock_guard lock(mRingsMutex);
+    Ring* ring = nullptr;
+    for (const auto& r : mRings)
+    {
+        if (r->thread == std::this_thread::get_id()) { ring = r.get(); }
+    }
+    if (ring == nullptr)
+    {
+        mRings.push_back(std::make_unique<Ring>());
+        ring = mRings.back().get();
+        ring->thread = std::this_thread::get_id();
+        ring->events.resize(mEventsPerThread);
+    }
+    tThreadTraceCache = { mId, ring };
+    return ring;
+}
+
+void TraceRecorder::Record(TraceEventType type, const TimedTaskInfo& task)
+{
+    Ring* ring = GetThreadRing();
+    const auto now = std::chrono::steady_clock::now();
+    while (ring->lock.test_and_set(std::memory_order_acquire)) {}
+    ring->events[ring->written++ % mEventsPerThread] = { type, task.taskInfo.tag, task.sequence, now };
+    ring->lock.clear(std::memory_order_release);
+}
+
+void TraceRecorder::DumpChromeTrace(std::ostream& out) const
+{
+    auto micros = [](std::chrono::time_point<std::chrono::steady_clock> time) {
+        return std::chrono::duration<double, std::micro>(time.time_since_epoch()).count();
+    };
+    auto writeName = [&out](const char* prefix, const char* tag) {
+        out << "\"name\":\"" << prefix;
+        for (const char* c = (tag != nullptr ? tag : "task"); *c != '\0'; c++)
+        {
+            if (*c == '"' || *c == '\\') { out << '\\'; }
+            if (static_cast<unsigned char>(*c) >= 0x20U) { out << *c; }
+        }
+        out << "\"";
+    };
+
+    std::lock_guard lock(mRingsMutex);
+    const auto flags = out.flags(); // `std::fixed` below must not leak into the caller's stream
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    std::vector<TraceEvent> events;
+    for (size_t tid = 0; tid < mRings.size(); tid++)
+    {
+        const Ring& ring = *mRings[tid];
+        while (ring.lock.test_and_set(std::memory_order_acquire)) {}
+        const uint64_t count = std::min<uint64_t>(ring.written, mEventsPerThread);
+        events.clear();
+        for (uint64_t i = ring.written - count; i < ring.written; i++)
+        {
+            events.push_back(ring.events[i % mEventsPerThread]);
+        }
+        ring.lock.clear(std::memory_order_release);
+
+        out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+            << ",\"name\":\"thread_name\",\"args\":{\"name\":\"thread " << ring.thread << "\"}}";
+        first = false;
+
+        for (const TraceEvent& event : events)
+        {
+            out << ",\n{\"pid\":1,\"tid\":" << tid << ",\"ts\":" << std::fixed << micros(event.time) << ",";
+            switch (event.type)
+            {
+            case TraceEventType::Insert:   out << "\"ph\":\"i\",\"s\":\"t\","; writeName("insert ", event.tag); break;
+            case TraceEventType::Expire:   out << "\"ph\":\"i\",\"s\":\"t\","; writeName("expire ", event.tag); break;
+            case TraceEventType::Dispatch: out << "\"ph\":\"i\",\"s\":\"t\","; writeName("dispatch ", event.tag); break;
+            case TraceEventType::Start:    out << "\"ph\":\"B\","; writeName("", event.tag); break;
+            case TraceEventType::End:      out << "\"ph\":\"E\","; writeName("", event.tag); break;
+            }
+            out << ",\"args\":{\"task\":" << event.sequence << "}}";
+        }
+    }
+    out << "\n]}\n";
+    out.flags(flags);
+}
+
+
+// The runner whose worker this thread is, if any
+thread_local const ParallelTaskRunner* tWorkerOfRunner = nullptr;
+
+ParallelTaskRunner::ParallelTaskRunner(const uint8_t numParallelThreads, QueueOrder order, uint32_t maxQueue, OverflowPolicy overflowPolicy,
+    const Clock* clock, TraceRecorder* tracer, AsyncLogger* logger)
+    : mOrder(order), mMaxQueue(maxQueue), mOverflowPolicy(overflowPolicy), mNumThreads(numParallelThreads), mClock(clock), mTracer(tracer), mLogger(logger)
+{
+    mRunning.store(true);
+    mCounters = std::make_unique<WorkerCounters[]>(numParallelThreads);
+    for (uint8_t i = 0; i < numParallelThreads; i++)
+    {
+        mThreads.emplace_back([this, i]{ this->Runner(i); });
     }
 }
 
@@ -215,43 +1608,687 @@ ParallelTaskRunner::~ParallelTaskRunner()
 
 void ParallelTaskRunner::Terminate()
 {
-    mRunning.store(false);
+    {
+        std::lock_guard lock(mQueueMutex);
+        mRunning.store(false);
+    }
     mCV.notify_all();
+    mSpaceCV.notify_all(); // blocked producers give up waiting
     for (auto& t : mThreads) { t.join(); }
+    mThreads.clear();
+
+    // Whatever is left is dropped, which completes it for its group
+    for (const QueuedTask& timedTask : mQueue) { LeaveGroup(timedTask.task.taskInfo); }
+    mQueue.clear();
+    for (auto& [strand, waiting] : mStrands)
+    {
+        for (; !waiting.empty(); waiting.pop()) { LeaveGroup(waiting.front().task.taskInfo); }
+    }
+    mStrands.clear();
+    mStrandWaiting = 0U;
+}
+
+void ParallelTaskRunner::RunTask(const TimedTaskInfo& task)
+{
+    RunTask(TimedTaskInfo(task)); // we must copy it
+}
+
+bool IsStale(const TimedTaskInfo& task, std::chrono::time_point<std::chrono::steady_clock> now) // not exported
+{
+    return task.taskInfo.maxStaleness > std::chrono::nanoseconds::zero() && now - task.deadline > task.taskInfo.maxStaleness;
 }
 
-void ParallelTaskRunner::RunTask(const TaskInfo& taskInfo)
+void ParallelTaskRunner::RunTask(TimedTaskInfo&& task)
 {
-    mSem.acquire();
-    mQueue.push(taskInfo); // we must copy it
-    mSem.release();
+    if (mTracer != nullptr) { mTracer->Record(TraceEventType::Dispatch, task); }
+    const auto now = mClock->Now();
+    if (IsStale(task, now))
+    {
+        // Already stale when dispatched: don't even queue the body
+        mStaleTasks.fetch_add(1U, std::memory_order_relaxed);
+        if (task.taskInfo.onStale == nullptr)
+        {
+            LeaveGroup(task.taskInfo);
+            return;
+        }
+        task.taskInfo.callback = std::move(task.taskInfo.onStale);
+        task.taskInfo.onStale = nullptr;
+        task.taskInfo.maxStaleness = std::chrono::nanoseconds::zero(); // the fallback runs however late
+    }
+    {
+        std::unique_lock lock(mQueueMutex);
+        if (mMaxQueue != 0U && mQueue.size() + mStrandWaiting >= mMaxQueue && !Overflow(task, lock))
+        {
+            return; // dropped, or ran inline
+        }
+        const uint64_t strand = task.taskInfo.strand;
+        if (strand != 0U)
+        {
+            auto [it, idle] = mStrands.try_emplace(strand);
+            if (!idle)
+            {
+                // waits for its predecessor, no worker needs to wake up
+                it->second.push({ std::move(task), now });
+                mStrandWaiting++;
+                mQueueDepth.store(mQueue.size() + mStrandWaiting, std::memory_order_relaxed);
+                return;
+            }
+        }
+        Enqueue({ std::move(task), now });
+        mQueueDepth.store(mQueue.size() + mStrandWaiting, std::memory_order_relaxed);
+    }
     mCV.notify_one();
 }
 
-void ParallelTaskRunner::Runner()
+std::chrono::time_point<std::chrono::steady_clock> CompletionDeadline(const QueuedTask& timedTask) // not exported
 {
-    // NOTE: std::println would be better, but that requires C++23 :(
-    std::cout << "Spawning task thread " << std::this_thread::get_id() << "\n";
-    std::mutex local_mutex;
+    return timedTask.task.deadline + timedTask.task.taskInfo.completeWithin;
+}
 
+void ParallelTaskRunner::Enqueue(QueuedTask&& timedTask)
+{
+    if (mOrder == QueueOrder::Fifo)
+    {
+        mQueue.push_back(std::move(timedTask));
+        return;
+    }
+    // After those with the same deadline, so ties stay in dispatch order
+    auto it = std::upper_bound(mQueue.begin(), mQueue.end(), timedTask, [](const QueuedTask& a, const QueuedTask& b) {
+        return CompletionDeadline(a) < CompletionDeadline(b);
+    });
+    mQueue.insert(it, std::move(timedTask));
+}
+
+bool ParallelTaskRunner::Overflow(TimedTaskInfo& task, std::unique_lock<std::mutex>& lock)
+{
+    OverflowPolicy policy = mOverflowPolicy;
+    if (policy == OverflowPolicy::Block && tWorkerOfRunner == this)
+    {
+        policy = OverflowPolicy::RunInline; // a worker waiting for a free slot might wait for itself
+    }
+    switch (policy)
+    {
+    case OverflowPolicy::Block:
+        mOverflowBlocked.fetch_add(1U, std::memory_order_relaxed);
+        mBlockedProducers++;
+        mSpaceCV.wait(lock, [this] { return mQueue.size() + mStrandWaiting < mMaxQueue || !mRunning.load(); });
+        mBlockedProducers--;
+        if (!mRunning.load())
+        {
+            Drop(task, false); // `Terminate` has drained the queue already, nobody would ever run it
+            return false;
+        }
+        return true;
+
+    case OverflowPolicy::RunInline:
+    {
+        const TaskInfo& taskInfo = task.taskInfo;
+        // Neither overtake its strand, nor queued tasks (or a waiting main thread) it conflicts with (see `NextRunnable`)
+        auto conflictsWith = [&](uint64_t reads, uint64_t writes) {
+            return (taskInfo.writes & (reads | writes)) != 0U || (taskInfo.reads & writes) != 0U;
+        };
+        const bool conflicts = ((taskInfo.reads | taskInfo.writes) != 0U)
+            && (conflictsWith(mPendingReads, mPendingWrites)
+                || std::any_of(mQueue.begin(), mQueue.end(), [&](const QueuedTask& queued) {
+                    return conflictsWith(queued.task.taskInfo.reads, queued.task.taskInfo.writes);
+                }));
+        if ((taskInfo.strand != 0U && mStrands.contains(taskInfo.strand)) || conflicts || !CanStart(taskInfo.reads, taskInfo.writes))
+        {
+            return true; // may not start yet, so it is queued anyway (beyond the bound)
+        }
+        mOverflowRanInline.fetch_add(1U, std::memory_order_relaxed);
+        if (taskInfo.strand != 0U) { mStrands.try_emplace(taskInfo.strand); } // later ones of the strand queue behind it
+        Claim(taskInfo.reads, taskInfo.writes);
+        mActive++;
+        QueuedTask inlineTask { std::move(task), mClock->Now() };
+        lock.unlock();
+        Execute(inlineTask);
+        lock.lock();
+        Finish(inlineTask);
+        return false;
+    }
+
+    case OverflowPolicy::DropLowestPriority:
+    {
+        // The first of the lowest is the oldest of them
+        auto lowest = std::min_element(mQueue.begin(), mQueue.end(), [](const QueuedTask& a, const QueuedTask& b) {
+            return a.task.taskInfo.priority < b.task.taskInfo.priority;
+        });
+        if (lowest == mQueue.end() || task.taskInfo.priority < lowest->task.taskInfo.priority)
+        {
+            Drop(task, false);
+            return false;
+        }
+        const QueuedTask dropped = std::move(*lowest);
+        mQueue.erase(lowest);
+        Drop(dropped.task, true);
+        return true;
+    }
+
+    case OverflowPolicy::DropOldest:
+    {
+        if (mQueue.empty()) // only strand waiting tasks, which must keep their order
+        {
+            Drop(task, false);
+            return false;
+        }
+        auto oldest = mQueue.begin();
+        if (mOrder != QueueOrder::Fifo)
+        {
+            oldest = std::min_element(mQueue.begin(), mQueue.end(), [](const QueuedTask& a, const QueuedTask& b) {
+                return a.enqueued < b.enqueued;
+            });
+        }
+        const QueuedTask dropped = std::move(*oldest);
+        mQueue.erase(oldest);
+        Drop(dropped.task, true);
+        return true;
+    }
+    }
+    return true;
+}
+
+void ParallelTaskRunner::Drop(const TimedTaskInfo& task, bool wasQueued)
+{
+    mOverflowDropped.fetch_add(1U, std::memory_order_relaxed);
+    if (wasQueued && task.taskInfo.strand != 0U)
+    {
+        HandOffStrand(task.taskInfo.strand); // strand tasks in `mQueue` are the head of their strand
+    }
+    if (task.taskInfo.group != nullptr && task.taskInfo.group->Leave())
+    {
+        mCV.notify_all(); // `Wait`
+    }
+    mQueueDepth.store(mQueue.size() + mStrandWaiting, std::memory_order_relaxed);
+}
+
+OverflowStats ParallelTaskRunner::GetOverflowStats() const
+{
+    OverflowStats stats;
+    stats.blocked = mOverflowBlocked.load(std::memory_order_relaxed);
+    stats.ranInline = mOverflowRanInline.load(std::memory_order_relaxed);
+    stats.dropped = mOverflowDropped.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<WorkerStats> ParallelTaskRunner::GetWorkerStats() const
+{
+    std::vector<WorkerStats> stats(mNumThreads);
+    for (size_t i = 0; i < stats.size(); i++)
+    {
+        const WorkerCounters& counters = mCounters[i];
+        stats[i].tasksExecuted = counters.tasksExecuted.load(std::memory_order_relaxed);
+        stats[i].busyTime = std::chrono::nanoseconds(counters.busyNanoseconds.load(std::memory_order_relaxed));
+        stats[i].idleTime = std::chrono::nanoseconds(counters.idleNanoseconds.load(std::memory_order_relaxed));
+        stats[i].wakeups = counters.wakeups.load(std::memory_order_relaxed);
+        stats[i].emptyWakeups = counters.emptyWakeups.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void ParallelTaskRunner::Runner(uint8_t index)
+{
+    mLogger->Log<LogLevel::Info>("Spawning task thread %u", static_cast<unsigned>(index));
+    tWorkerOfRunner = this;
+
+    // Only this thread writes its counters, so plain load+store instead of read-modify-write
+    WorkerCounters& counters = mCounters[index];
+    auto add = [](std::atomic_uint64_t& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    };
+
+    std::unique_lock lock(mQueueMutex);
     while (mRunning.load())
     {
-        std::unique_lock lk(local_mutex);
-        mSem.acquire();
-        if (mQueue.empty())
+        size_t next = NextRunnable();
+        if (next == mQueue.size())
+        {
+            // nothing queued, or all of it blocked by resources of running tasks
+            const auto parked = std::chrono::steady_clock::now();
+            mCV.wait(lock); // spurious wakeups may also occur, but even then we still continue loop!
+            add(counters.idleNanoseconds, static_cast<uint64_t>((std::chrono::steady_clock::now() - parked).count()));
+            add(counters.wakeups, 1U);
+            if (NextRunnable() == mQueue.size() && mRunning.load()) { add(counters.emptyWakeups, 1U); }
+            continue;
+        }
+        QueuedTask timedTask = Take(next);
+        lock.unlock();
+
+        const auto start = std::chrono::steady_clock::now();
+        Execute(timedTask);
+        add(counters.busyNanoseconds, static_cast<uint64_t>(std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count()));
+        add(counters.tasksExecuted, 1U);
+
+        lock.lock();
+        Finish(timedTask);
+    }
+    lock.unlock();
+
+    mLogger->Log<LogLevel::Info>("Ending task thread %u", static_cast<unsigned>(index));
+}
+
+QueuedTask ParallelTaskRunner::Take(size_t index)
+{
+    QueuedTask timedTask = std::move(mQueue[index]);
+    mQueue.erase(mQueue.begin() + static_cast<std::ptrdiff_t>(index));
+    Claim(timedTask.task.taskInfo.reads, timedTask.task.taskInfo.writes);
+    mActive++;
+    mQueueDepth.store(mQueue.size() + mStrandWaiting, std::memory_order_relaxed);
+    if (mBlockedProducers != 0U) { mSpaceCV.notify_one(); }
+    return timedTask;
+}
+
+void ParallelTaskRunner::Execute(QueuedTask& timedTask)
+{
+    const auto clockStart = mClock->Now();
+    mQueueDelay.Record(clockStart - timedTask.enqueued);
+    TaskInfo& taskInfo = timedTask.task.taskInfo;
+    if (IsStale(timedTask.task, clockStart))
+    {
+        mStaleTasks.fetch_add(1U, std::memory_order_relaxed);
+        taskInfo.callback = std::move(taskInfo.onStale); // if any
+    }
+    else
+    {
+        mLateness.Record(clockStart - timedTask.task.deadline);
+    }
+    if (taskInfo.callback != nullptr)
+    {
+        if (mTracer != nullptr) { mTracer->Record(TraceEventType::Start, timedTask.task); }
+        taskInfo.callback();
+        if (mTracer != nullptr) { mTracer->Record(TraceEventType::End, timedTask.task); }
+    }
+    taskInfo.callback = nullptr; // release it outside of the lock
+    taskInfo.onStale = nullptr;
+}
+
+void ParallelTaskRunner::Finish(const QueuedTask& timedTask)
+{
+    if (Unclaim(timedTask.task.taskInfo.reads, timedTask.task.taskInfo.writes))
+    {
+        mCV.notify_all(); // blocked tasks may start now, also a main-thread `AcquireResources`
+    }
+    if (timedTask.task.taskInfo.strand != 0U)
+    {
+        HandOffStrand(timedTask.task.taskInfo.strand);
+    }
+    const bool groupDone = timedTask.task.taskInfo.group != nullptr && timedTask.task.taskInfo.group->Leave();
+    if ((--mActive == 0U && mQueue.empty()) || groupDone)
+    {
+        mCV.notify_all(); // `WaitIdle`/`Wait`
+    }
+}
+
+void ParallelTaskRunner::HandOffStrand(uint64_t strand)
+{
+    // Hand the strand to its next task, or retire it
+    auto it = mStrands.find(strand);
+    if (it->second.empty())
+    {
+        mStrands.erase(it);
+    }
+    else
+    {
+        Enqueue(std::move(it->second.front()));
+        it->second.pop();
+        mStrandWaiting--;
+        mCV.notify_one(); // we may pick another task first
+    }
+}
+
+void ParallelTaskRunner::WaitIdle()
+{
+    Help(nullptr);
+}
+
+void ParallelTaskRunner::Wait(const TaskGroup& group)
+{
+    Help(&group);
+}
+
+void ParallelTaskRunner::NotifyGroupDone()
+{
+    {
+        std::lock_guard lock(mQueueMutex); // a waiter is either before its check or waiting
+    }
+    mCV.notify_all();
+}
+
+void ParallelTaskRunner::LeaveGroup(const TaskInfo& taskInfo)
+{
+    if (taskInfo.group != nullptr && taskInfo.period <= std::chrono::nanoseconds::zero() && taskInfo.group->Leave())
+    {
+        NotifyGroupDone();
+    }
+}
+
+void ParallelTaskRunner::Help(const TaskGroup* group)
+{
+    // Groups complete under `mQueueMutex` (see `Finish`/`NotifyGroupDone`), so the checks below
+    // cannot miss it, and the group is not touched anymore once this returns.
+    auto done = [&] { return (group != nullptr) ? group->IsDone() : (mQueue.empty() && mActive == 0U); };
+    std::unique_lock lock(mQueueMutex);
+    while (!done())
+    {
+        const size_t next = NextRunnable();
+        if (next < mQueue.size())
         {
-            mSem.release();
-            mCV.wait(lk); // spurious wakeups may also occur, but even then we still continue loop!
+            // Help instead of idling
+            QueuedTask timedTask = Take(next);
+            lock.unlock();
+            Execute(timedTask);
+            mHelpedTasks.fetch_add(1U, std::memory_order_relaxed);
+            lock.lock();
+            Finish(timedTask);
             continue;
         }
-        TaskInfo timedTask = mQueue.front();
-        mQueue.pop();
-        mSem.release();
+        mCV.wait(lock); // only tasks blocked by resources or running ones are left
+    }
+}
+
+bool ParallelTaskRunner::CanStart(uint64_t reads, uint64_t writes) const
+{
+    return (writes & (mReadMask | mWriteMask)) == 0U && (reads & mWriteMask) == 0U;
+}
+
+void ParallelTaskRunner::Claim(uint64_t reads, uint64_t writes)
+{
+    for (uint64_t bits = reads; bits != 0U; bits &= bits - 1U)
+    {
+        mReaders[std::countr_zero(bits)]++;
+    }
+    mReadMask |= reads;
+    mWriteMask |= writes;
+}
+
+bool ParallelTaskRunner::Unclaim(uint64_t reads, uint64_t writes)
+{
+    for (uint64_t bits = reads; bits != 0U; bits &= bits - 1U)
+    {
+        const int bit = std::countr_zero(bits);
+        if (--mReaders[bit] == 0U) { mReadMask &= ~(uint64_t(1U) << bit); }
+    }
+    mWriteMask &= ~writes;
+    return (reads | writes) != 0U;
+}
+
+size_t ParallelTaskRunner::NextRunnable() const
+{
+    // Resources of skipped tasks fence off later conflicting ones, so that e.g. a blocked writer
+    // is not starved by a stream of readers, and conflicting tasks keep their dispatch order.
+    uint64_t fencedReads = mPendingReads;
+    uint64_t fencedWrites = mPendingWrites;
+    for (size_t i = 0; i < mQueue.size(); i++)
+    {
+        const TaskInfo& taskInfo = mQueue[i].task.taskInfo;
+        const uint64_t reads = taskInfo.reads;
+        const uint64_t writes = taskInfo.writes;
+        const bool fenced = (writes & (fencedReads | fencedWrites)) != 0U || (reads & fencedWrites) != 0U;
+        if (!fenced && CanStart(reads, writes)) { return i; }
+        fencedReads |= reads;
+        fencedWrites |= writes;
+    }
+    return mQueue.size();
+}
+
+void ParallelTaskRunner::AcquireResources(uint64_t reads, uint64_t writes)
+{
+    std::unique_lock lock(mQueueMutex);
+    if (CanStart(reads, writes))
+    {
+        Claim(reads, writes);
+        return;
+    }
+    mPendingReads = reads; // the workers start no conflicting task meanwhile
+    mPendingWrites = writes;
+    mCV.wait(lock, [&] { return CanStart(reads, writes); });
+    mPendingReads = 0U;
+    mPendingWrites = 0U;
+    Claim(reads, writes);
+}
+
+void ParallelTaskRunner::ReleaseResources(uint64_t reads, uint64_t writes)
+{
+    {
+        std::lock_guard lock(mQueueMutex);
+        Unclaim(reads, writes);
+    }
+    mCV.notify_all();
+}
+
+
+void PostQueue::Push(PostedTask* node)
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    PostedTask* previous = mHead.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release); // until here, the consumer sees a gap
+}
+
+PostedTask* PostQueue::Pop()
+{
+    PostedTask* tail = mTail;
+    PostedTask* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &mStub)
+    {
+        if (next == nullptr) { return nullptr; }
+        mTail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr)
+    {
+        mTail = next;
+        return tail;
+    }
+    if (tail != mHead.load(std::memory_order_acquire)) { return nullptr; } // push in progress
+
+    // `tail` is the last node, put the stub behind it so it can be handed out
+    Push(&mStub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr)
+    {
+        mTail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+
+// Moves a periodic task to its next occurrence, returns how many were skipped
+uint64_t Reschedule(TimedTaskInfo& task, std::chrono::time_point<std::chrono::steady_clock> now, CatchUpPolicy policy) // not exported
+{
+    const auto period = task.taskInfo.period;
+    task.deadline += period;
+    if (policy != CatchUpPolicy::SkipMissedPeriodic || task.deadline > now) { return 0U; }
+    const auto missed = (now - task.deadline) / period + 1;
+    task.deadline += missed * period;
+    return static_cast<uint64_t>(missed);
+}
+
+ParallelTimer::ParallelTimer(uint16_t maxSize, CatchUpPolicy policy, const Clock* clock, const std::atomic<std::chrono::nanoseconds::rep>* offset,
+    ParallelTaskRunner* runner, OverloadController* overload, LatencyHistogram* dispatchLateness, TraceRecorder* tracer, AsyncLogger* logger)
+    : mMaxSize(maxSize), mCatchUpPolicy(policy), mClock(clock), mOffset(offset), mRunner(runner), mOverload(overload),
+      mDispatchLateness(dispatchLateness), mTracer(tracer), mLogger(logger)
+{
+    mHeap.reserve(maxSize);
+    mThread = std::thread(&ParallelTimer::Run, this);
+}
+
+ParallelTimer::~ParallelTimer()
+{
+    Terminate(false);
+}
+
+std::chrono::time_point<std::chrono::steady_clock> ParallelTimer::Now() const
+{
+    return mClock->Now() - std::chrono::nanoseconds(mOffset->load(std::memory_order_relaxed));
+}
+
+void ParallelTimer::Insert(TimedTaskInfo&& task)
+{
+    auto later = [](const TimedTaskInfo& a, const TimedTaskInfo& b) { return FiresBefore(b, a); };
+    bool earlier = false;
+    {
+        std::lock_guard lock(mMutex);
+        if (mHeap.size() >= mMaxSize)
+        {
+            mLogger->Log<LogLevel::Error>("[ParallelTimer] maxSize reached, task is dropped!");
+            mRunner->LeaveGroup(task.taskInfo);
+            return;
+        }
+        if (mTracer != nullptr) { mTracer->Record(TraceEventType::Insert, task); }
+        const auto latest = FireTime(task) + task.taskInfo.slack;
+        earlier = (latest < mNextWakeUp);
+        if (earlier) { mNextWakeUp = latest; }
+        mHeap.push_back(std::move(task));
+        std::push_heap(mHeap.begin(), mHeap.end(), later);
+    }
+    if (earlier)
+    {
+        mCV.notify_one(); // the timer thread sleeps until the previous `mNextWakeUp`
+    }
+}
+
+void ParallelTimer::Terminate(bool dispatchPending)
+{
+    {
+        std::lock_guard lock(mMutex);
+        if (mStopping) { return; }
+        mStopping = true;
+    }
+    mCV.notify_one();
+    mThread.join();
+
+    std::sort(mHeap.begin(), mHeap.end(), &FiresBefore);
+    for (TimedTaskInfo& task : mHeap)
+    {
+        if (dispatchPending)
+        {
+            if (task.taskInfo.group != nullptr && task.taskInfo.period > std::chrono::nanoseconds::zero())
+            {
+                task.taskInfo.group->Enter(); // a last occurrence
+            }
+            task.taskInfo.period = std::chrono::nanoseconds::zero();
+            mRunner->RunTask(std::move(task));
+        }
+        else
+        {
+            mRunner->LeaveGroup(task.taskInfo);
+        }
+    }
+    mHeap.clear();
+}
+
+void ParallelTimer::Run()
+{
+    mLogger->Log<LogLevel::Info>("Spawning timer thread");
+    auto later = [](const TimedTaskInfo& a, const TimedTaskInfo& b) { return FiresBefore(b, a); };
+
+    std::unique_lock lock(mMutex);
+    while (!mStopping)
+    {
+        if (mHeap.empty())
+        {
+            mNextWakeUp = std::chrono::time_point<std::chrono::steady_clock>::max(); // any `Insert` wakes it up
+            mCV.wait(lock);
+            continue;
+        }
+        const auto now = Now();
+        const TimedTaskInfo& earliest = mHeap.front();
+        if (FireTime(earliest) > now)
+        {
+            // the front fires first, but not necessarily has the earliest deadline + slack
+            mNextWakeUp = std::chrono::time_point<std::chrono::steady_clock>::max();
+            for (const TimedTaskInfo& task : mHeap) { mNextWakeUp = std::min(mNextWakeUp, FireTime(task) + task.taskInfo.slack); }
+            // may be woken up earlier by `Insert`, which is why the deadline is re-checked
+            mCV.wait_for(lock, mNextWakeUp - now);
+            continue;
+        }
+
+        std::pop_heap(mHeap.begin(), mHeap.end(), later);
+        TimedTaskInfo task = std::move(mHeap.back());
+        mHeap.pop_back();
+        const OverloadAction action = (mOverload != nullptr) ? mOverload->Admit(task.taskInfo.priority) : OverloadAction::Run;
+        if (action == OverloadAction::Defer)
+        {
+            task.notBefore = now + mOverload->GetDeferBy();
+            mHeap.push_back(std::move(task));
+            std::push_heap(mHeap.begin(), mHeap.end(), later);
+            continue;
+        }
+        const bool periodic = task.taskInfo.period > std::chrono::nanoseconds::zero();
+        if (periodic)
+        {
+            mHeap.push_back(task); // the original stays for the next occurrence
+            mSkippedPeriodic.fetch_add(Reschedule(mHeap.back(), now, mCatchUpPolicy), std::memory_order_relaxed);
+            std::push_heap(mHeap.begin(), mHeap.end(), later);
+            task.taskInfo.period = std::chrono::nanoseconds::zero(); // this occurrence is a one-shot task
+        }
+        if (action == OverloadAction::Shed)
+        {
+            if (!periodic) { mRunner->LeaveGroup(task.taskInfo); }
+            continue;
+        }
+        if (periodic && task.taskInfo.group != nullptr) { task.taskInfo.group->Enter(); }
+        lock.unlock();
+
+        if (mTracer != nullptr) { mTracer->Record(TraceEventType::Expire, task); }
+        mDispatchLateness->Record(now - task.deadline);
+        task.deadline += std::chrono::nanoseconds(mOffset->load(std::memory_order_relaxed)); // the runner measures with the clock
+        mRunner->RunTask(std::move(task));
+
+        lock.lock();
+    }
+    lock.unlock();
+
+    mLogger->Log<LogLevel::Info>("Ending timer thread");
+}
+
+
+OverloadController::OverloadController(const OverloadInfo& info, std::chrono::time_point<std::chrono::steady_clock> now)
+    : mInfo(info), mDeferBy(std::max<std::chrono::nanoseconds>(info.deferBy, 1ms)), mNextEvaluation(now + info.window)
+{
+}
+
+void OverloadController::Evaluate(std::chrono::time_point<std::chrono::steady_clock> now, const LatencyHistogram& mainLateness,
+    const ParallelTaskRunner* runner)
+{
+    if (now < mNextEvaluation) { return; }
+    mNextEvaluation = now + mInfo.window;
+
+    mReport.parallelQueueDepth = (runner != nullptr) ? static_cast<uint32_t>(runner->GetQueueDepth()) : 0U;
+    mReport.mainLatenessP99 = mainLateness.Since(mMainMark).p99;
+    mReport.parallelLatenessP99 = (runner != nullptr) ? runner->GetLatenessSince(mParallelMark).p99 : std::chrono::nanoseconds::zero();
+    const bool deep = mInfo.maxParallelQueueDepth != 0U && mReport.parallelQueueDepth > mInfo.maxParallelQueueDepth;
+    const bool late = mInfo.maxLatenessP99 > std::chrono::nanoseconds::zero()
+        && std::max(mReport.mainLatenessP99, mReport.parallelLatenessP99) > mInfo.maxLatenessP99;
+
+    // One class per window either way, so a single bad window does not shed everything, and
+    // shedding does not flap as soon as it helped
+    const uint8_t level = mLevel.load(std::memory_order_relaxed);
+    const uint8_t next = (deep || late) ? std::min<uint8_t>(level + 1U, 3U) : static_cast<uint8_t>(level - (level > 0U ? 1U : 0U));
+    if (next == level) { return; }
+    mLevel.store(next, std::memory_order_relaxed);
+    if (mInfo.onOverload) { mInfo.onOverload(GetReport()); }
+}
 
-        timedTask.callback();
-    }
+OverloadReport OverloadController::GetReport() const
+{
+    OverloadReport report = mReport;
+    report.level = mLevel.load(std::memory_order_relaxed);
+    report.shed = mShed.load(std::memory_order_relaxed);
+    report.deferrals = mDeferrals.load(std::memory_order_relaxed);
+    return report;
+}
 
-    std::cout << "Ending task thread " << std::this_thread::get_id() << "\n";
+OverloadAction OverloadController::Admit(TaskPriority priority)
+{
+    const uint8_t priorityClass = static_cast<uint8_t>(priority);
+    if (priorityClass >= mLevel.load(std::memory_order_relaxed)) { return OverloadAction::Run; } // Critical is 3, the highest level
+    const OverloadAction action = mInfo.actions[priorityClass];
+    if (action == OverloadAction::Shed) { mShed.fetch_add(1U, std::memory_order_relaxed); }
+    else if (action == OverloadAction::Defer) { mDeferrals.fetch_add(1U, std::memory_order_relaxed); }
+    return action;
 }
 
 
@@ -259,105 +2296,725 @@ TaskScheduler::TaskScheduler(const TaskSchedulerInfo& info)
 {
     mRunning = true;
     mParallelExecutionAllowed = info.numParallelThreads > 0U;
+    mCallbackPool = new CallbackPool(std::clamp<uint32_t>(info.maxSize, 16U, 1024U));
+    mCatchUpPolicy = info.catchUpPolicy;
+    mMaxCatchUp = info.maxCatchUp;
+    mCatchUpFrames = std::max(info.catchUpFrames, 1U);
+    mClock = (info.clock != nullptr) ? info.clock : &gSteadyClock;
+    mLogger = new AsyncLogger(info.logSink);
+    if (info.fixedTimestep > std::chrono::nanoseconds::zero())
+    {
+        if (info.clock != nullptr)
+        {
+            mLogger->Log<LogLevel::Warning>("[TaskScheduler] fixedTimestep is set, so the given clock is ignored!");
+        }
+        mFixedClock = new ManualClock();
+        mFixedTimestep = info.fixedTimestep;
+        mClock = mFixedClock;
+    }
+    if (info.enableTracing)
+    {
+        mTracer = new TraceRecorder(info.traceEventsPerThread);
+    }
+    if (info.overload.maxParallelQueueDepth != 0U || info.overload.maxLatenessP99 > std::chrono::nanoseconds::zero())
+    {
+        mOverload = new OverloadController(info.overload, mClock->Now());
+    }
     if (mParallelExecutionAllowed)
     {
-        mParallelRunner = new ParallelTaskRunner(info.numParallelThreads);
+        mParallelRunner = new ParallelTaskRunner(info.numParallelThreads, info.parallelQueueOrder, info.maxParallelQueue, info.overflowPolicy, mClock, mTracer, mLogger);
+        if (info.parallelTimerThread && (info.clock != nullptr || mFixedClock != nullptr))
+        {
+            mLogger->Log<LogLevel::Warning>("[TaskScheduler] parallelTimerThread needs the real clock, so it is ignored!");
+        }
+        else if (info.parallelTimerThread)
+        {
+            mParallelTimer = new ParallelTimer(info.maxSize, mCatchUpPolicy, mClock, &mCatchUpOffset,
+                mParallelRunner, mOverload, &mDispatchLateness, mTracer, mLogger);
+        }
     }
     mContainer = new TaskContainer(info.maxSize);
-    mTimer = std::chrono::steady_clock::now();
-    mElapsed = {};
+    mTimer = mClock->Now();
+    mNextDeadline = std::chrono::time_point<std::chrono::steady_clock>::max();
+    mIterationNextDeadline = std::chrono::time_point<std::chrono::steady_clock>::max();
 }
 
 TaskScheduler::~TaskScheduler()
 {
     mRunning = false;
+    delete mParallelTimer; // before the runner it dispatches to
     if (mParallelRunner != nullptr)
     {
         delete mParallelRunner;
     }
     delete mContainer;
+    delete mTracer;
+    delete mOverload; // after the timer thread which admits tasks
+    delete mFixedClock;
+    // Everything holding callbacks is gone, but the vectors are members, so release them first
+    DrainPosted();
+    mDeferred = {};
+    mExpiredParallel = {};
+    mInbox = {};
+    mInboxSwap = {};
+    delete mCallbackPool;
+    delete mLogger; // last, so everything above may still log
+
+#if defined(__linux__)
+    if (mPollFd != -1)
+    {
+        close(mPollFd);
+        close(mTimerFd);
+        close(mEventFd);
+    }
+#endif
 }
 
 void TaskScheduler::ProcessTasks()
 {
-    auto now = std::chrono::steady_clock::now();
-    mElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - mTimer);
+    ProcessTasks(std::chrono::microseconds::max());
+}
+
+void TaskScheduler::ProcessTasks(std::chrono::microseconds budget)
+{
+    CatchUp();
+    mTimer = Now();
+    if (mOverload != nullptr)
+    {
+        mOverload->Evaluate(mTimer, mMainLateness, mParallelRunner);
+    }
+#if defined(__linux__)
+    int timerFd = -1;
+    int eventFd = -1;
+    {
+        std::lock_guard lock(mInboxMutex); // `GetPollFd` may create them on another thread
+        timerFd = mTimerFd;
+        eventFd = mEventFd;
+    }
+    if (timerFd != -1)
+    {
+        // reset readiness, failing with EAGAIN just means the fd was not signaled
+        uint64_t count;
+        [[maybe_unused]] ssize_t r = read(timerFd, &count, sizeof(count));
+        r = read(eventFd, &count, sizeof(count));
+    }
+#endif
+    DrainInbox();
+    DrainPosted();
 
+    mIterationNextDeadline = std::chrono::time_point<std::chrono::steady_clock>::max();
     mContainer->ForEach(std::bind(&TaskScheduler::ForEachTask, this, std::placeholders::_1));
     mContainer->PostIterate();
 
-    mTimer = now;
+    std::sort(mExpiredParallel.begin(), mExpiredParallel.end(), &FiresBefore);
+    const std::chrono::nanoseconds offset(mCatchUpOffset.load(std::memory_order_relaxed));
+    for (TimedTaskInfo& timedTaskInfo : mExpiredParallel)
+    {
+        timedTaskInfo.deadline += offset; // the runner measures lateness with the clock
+        mParallelRunner->RunTask(std::move(timedTaskInfo));
+    }
+    mExpiredParallel.clear();
+    {
+        // tasks added while iterating are already accounted for by `InsertTimedTask`
+        std::lock_guard lock(mInboxMutex);
+        mNextDeadline = std::min(mNextDeadline, mIterationNextDeadline);
+    }
+
+    RunDeferredTasks(budget);
+#if defined(__linux__)
+    ArmPollFd();
+#endif
+}
+
+void TaskScheduler::CatchUp()
+{
+    std::chrono::time_point<std::chrono::steady_clock> nextDeadline;
+    {
+        std::lock_guard lock(mInboxMutex);
+        nextDeadline = mNextDeadline;
+    }
+
+    // How much longer than the previous frame was this one, while tasks were overdue? So neither a
+    // low frame rate nor sleeping until the next deadline (see `mLastProcessed`) is a stall.
+    std::chrono::nanoseconds offset(mCatchUpOffset.load(std::memory_order_relaxed));
+    const auto clockNow = mClock->Now();
+    std::chrono::nanoseconds lag {0};
+    if (mLastProcessed != std::chrono::time_point<std::chrono::steady_clock>::min())
+    {
+        const std::chrono::nanoseconds frameTime = clockNow - mLastProcessed;
+        if (mFrameTime >= std::chrono::nanoseconds::zero() && nextDeadline != std::chrono::time_point<std::chrono::steady_clock>::max())
+        {
+            const std::chrono::nanoseconds overdue = clockNow - std::max(nextDeadline + offset, mLastProcessed);
+            lag = std::max(std::min(frameTime - mFrameTime, overdue), std::chrono::nanoseconds::zero());
+        }
+        mFrameTime = frameTime;
+    }
+    mLastProcessed = clockNow;
+    if (lag > mMaxCatchUp && mFixedClock == nullptr) // fixed-timestep mode cannot stall
+    {
+        mStats.stalls++;
+        mStats.lastStall = std::chrono::duration_cast<std::chrono::microseconds>(lag - mMaxCatchUp);
+        if (mCatchUpPolicy == CatchUpPolicy::Clamp || mCatchUpPolicy == CatchUpPolicy::Spread)
+        {
+            offset += lag - mMaxCatchUp;
+            mCatchUpStep = std::max(offset / mCatchUpFrames, std::chrono::nanoseconds(1));
+        }
+        if (mCatchUpPolicy != CatchUpPolicy::FireAll) // which just fires the backlog, like every late frame
+        {
+            mLogger->Log<LogLevel::Warning>("[TaskScheduler] stall detected, the frame took %lld ms longer than the previous one",
+                static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(lag).count()));
+        }
+    }
+    else if (mCatchUpPolicy == CatchUpPolicy::Spread && offset > std::chrono::nanoseconds::zero())
+    {
+        offset -= std::min(offset, mCatchUpStep);
+    }
+    mCatchUpOffset.store(offset.count(), std::memory_order_relaxed);
+    mStats.catchUpDebt = std::chrono::duration_cast<std::chrono::microseconds>(offset);
+}
+
+std::chrono::time_point<std::chrono::steady_clock> TaskScheduler::Now() const
+{
+    return mClock->Now() - std::chrono::nanoseconds(mCatchUpOffset.load(std::memory_order_relaxed));
+}
+
+void TaskScheduler::ProcessTasks(uint32_t ticks)
+{
+    if (mFixedClock == nullptr)
+    {
+        mLogger->Log<LogLevel::Error>("[TaskScheduler::ProcessTasks] ticks require TaskSchedulerInfo::fixedTimestep!");
+        return;
+    }
+    for (uint32_t i = 0; i < ticks; i++)
+    {
+        // One step at a time, so a task added by a callback in tick N can fire in tick N+1
+        mFixedClock->Advance(mFixedTimestep);
+        mTick++;
+        ProcessTasks(); // no budget, that would depend on how fast this machine is
+    }
+}
+
+void TaskScheduler::RunDeferredTasks(std::chrono::microseconds budget)
+{
+    // Most overdue first, equal deadlines in insertion order
+    std::sort(mDeferred.begin(), mDeferred.end(), &FiresBefore);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::chrono::microseconds spent {0};
+    size_t executed = 0;
+    while (executed < mDeferred.size())
+    {
+        // always execute at least one task, otherwise a too small budget would starve everything
+        if (executed > 0 && spent >= budget) { break; }
+        const TimedTaskInfo& deferred = mDeferred[executed++];
+        mMainLateness.Record(Now() - deferred.deadline);
+        RunOnMainThread(deferred);
+        spent = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    }
+    mDeferred.erase(mDeferred.begin(), mDeferred.begin() + executed);
+
+    mStats.lastFrameExecutedTasks = static_cast<uint32_t>(executed);
+    mStats.lastFrameExecutionTime = spent;
+    mStats.deferredTasks = static_cast<uint32_t>(mDeferred.size());
+    mStats.peakDeferredTasks = std::max(mStats.peakDeferredTasks, mStats.deferredTasks);
+    mStats.totalDeferrals += mDeferred.size();
+    // Tasks postponed by `OverloadAction::Defer` fire after later deadlines, so the front is not necessarily the latest
+    const auto oldest = std::min_element(mDeferred.begin(), mDeferred.end(),
+        [](const TimedTaskInfo& a, const TimedTaskInfo& b) { return a.deadline < b.deadline; });
+    mStats.maxDeferredLateness = mDeferred.empty() ? std::chrono::microseconds{0}
+        : std::chrono::duration_cast<std::chrono::microseconds>(mTimer - oldest->deadline);
+}
+
+void TaskScheduler::RunOnMainThread(const TimedTaskInfo& timedTaskInfo)
+{
+    const uint64_t reads = timedTaskInfo.taskInfo.reads;
+    const uint64_t writes = timedTaskInfo.taskInfo.writes;
+    const bool claims = (reads | writes) != 0U && mParallelRunner != nullptr;
+    if (claims) { mParallelRunner->AcquireResources(reads, writes); } // waits for conflicting parallel tasks
+    if (mTracer != nullptr) { mTracer->Record(TraceEventType::Start, timedTaskInfo); }
+    timedTaskInfo.taskInfo.callback();
+    if (mTracer != nullptr) { mTracer->Record(TraceEventType::End, timedTaskInfo); }
+    if (claims) { mParallelRunner->ReleaseResources(reads, writes); }
+    LeaveGroup(timedTaskInfo.taskInfo);
 }
 
 bool TaskScheduler::ForEachTask(TimedTaskInfo& timedTaskInfo)
 {
-    bool elapsed = (mElapsed >= timedTaskInfo.duration);
-    if (elapsed)
+    const auto period = timedTaskInfo.taskInfo.period;
+    // Periodic tasks stay in the container with their next deadline. Every missed occurrence
+    // fires, unless skipped by the catch-up policy (Clamp/Spread bound how many there can be).
+    while (FireTime(timedTaskInfo) <= mTimer)
     {
-        // TODO: Possible semaphore contention! (may create temporary storage) [optimization]
-        // TODO: Or maybe use a semaphore that is based on spinlock instead of mutex!
-        // This is only an issue if many tasks need execution in the same frame!
-        // Otherwise it is a non-issue.
+        if (mTracer != nullptr) { mTracer->Record(TraceEventType::Expire, timedTaskInfo); }
 
-        if (timedTaskInfo.taskInfo.forceSynchronous || !mParallelExecutionAllowed)
+        const OverloadAction action = (mOverload != nullptr) ? mOverload->Admit(timedTaskInfo.taskInfo.priority) : OverloadAction::Run;
+        if (action == OverloadAction::Defer)
         {
-            timedTaskInfo.taskInfo.callback();
+            timedTaskInfo.notBefore = mTimer + mOverload->GetDeferBy(); // a periodic one keeps its schedule
+            break;
         }
-        else
+        if (action == OverloadAction::Shed)
+        {
+            if (period <= std::chrono::nanoseconds::zero())
+            {
+                LeaveGroup(timedTaskInfo.taskInfo);
+                return true;
+            }
+            mStats.skippedPeriodic += Reschedule(timedTaskInfo, mTimer, mCatchUpPolicy); // only this occurrence is shed
+            continue;
+        }
+
+        // Main-thread tasks are executed after iteration (see `RunDeferredTasks`), parallel ones
+        // dispatched in firing order after iteration
+        const bool synchronous = timedTaskInfo.taskInfo.forceSynchronous || !mParallelExecutionAllowed;
+        std::vector<TimedTaskInfo>& expired = synchronous ? mDeferred : mExpiredParallel;
+        if (!synchronous) { mDispatchLateness.Record(mTimer - timedTaskInfo.deadline); }
+
+        if (period <= std::chrono::nanoseconds::zero())
         {
-            mParallelRunner->RunTask(timedTaskInfo.taskInfo);
+            expired.push_back(std::move(timedTaskInfo)); // the slot is cleared by `PostIterate` anyway
+            return true;
         }
+        expired.push_back(timedTaskInfo); // the original stays for the next occurrence
+        expired.back().taskInfo.period = std::chrono::nanoseconds::zero(); // this occurrence is a one-shot task
+        if (timedTaskInfo.taskInfo.group != nullptr) { timedTaskInfo.taskInfo.group->Enter(); }
+        mStats.skippedPeriodic += Reschedule(timedTaskInfo, mTimer, mCatchUpPolicy);
     }
-    else
+    mIterationNextDeadline = std::min(mIterationNextDeadline, FireTime(timedTaskInfo) + timedTaskInfo.taskInfo.slack);
+    return false;
+}
+
+void TaskScheduler::LeaveGroup(const TaskInfo& taskInfo)
+{
+    if (mParallelRunner != nullptr)
+    {
+        mParallelRunner->LeaveGroup(taskInfo); // there may be a `Wait` on another thread
+    }
+    else if (taskInfo.group != nullptr && taskInfo.period <= std::chrono::nanoseconds::zero())
     {
-        timedTaskInfo.duration -= mElapsed;
+        taskInfo.group->Leave(); // nobody can `Wait` without parallel threads, only poll
     }
-    return elapsed;
 }
 
-bool TaskScheduler::ForceRunEachTask(const TimedTaskInfo& timedTaskInfo)
+bool TaskScheduler::ForceRunEachTask(TimedTaskInfo& timedTaskInfo)
 {
+    if (timedTaskInfo.taskInfo.period > std::chrono::nanoseconds::zero())
+    {
+        timedTaskInfo.taskInfo.period = std::chrono::nanoseconds::zero(); // a last occurrence
+        if (timedTaskInfo.taskInfo.group != nullptr) { timedTaskInfo.taskInfo.group->Enter(); }
+    }
     if (timedTaskInfo.taskInfo.forceSynchronous || !mParallelExecutionAllowed)
     {
-        timedTaskInfo.taskInfo.callback();
+        RunOnMainThread(timedTaskInfo);
     }
     else
     {
-        mParallelRunner->RunTask(timedTaskInfo.taskInfo);
+        mParallelRunner->RunTask(std::move(timedTaskInfo)); // removed from the container anyway
     }
     return true;
 }
 
+void TaskScheduler::AddTickTask(uint32_t ticks, const TaskInfo& taskInfo)
+{
+    AddTickTask(ticks, TaskInfo(taskInfo));
+}
+
+void TaskScheduler::AddTickTask(uint32_t ticks, TaskInfo&& taskInfo)
+{
+    if (mFixedClock == nullptr)
+    {
+        mLogger->Log<LogLevel::Error>("[TaskScheduler::AddTickTask] requires TaskSchedulerInfo::fixedTimestep!");
+        return;
+    }
+    InsertTimedTask(Now() + mFixedTimestep * ticks, std::move(taskInfo));
+}
+
+TaskSchedulerStats TaskScheduler::GetStats() const
+{
+    TaskSchedulerStats stats = mStats;
+    stats.mainLateness = mMainLateness.Snapshot();
+    stats.parallelDispatchLateness = mDispatchLateness.Snapshot();
+    if (mParallelRunner != nullptr)
+    {
+        stats.parallelLateness = mParallelRunner->GetLateness();
+        stats.parallelQueueDelay = mParallelRunner->GetQueueDelay();
+        stats.parallelHelpedTasks = mParallelRunner->GetHelpedTasks();
+        stats.parallelOverflow = mParallelRunner->GetOverflowStats();
+        stats.parallelStaleTasks = mParallelRunner->GetStaleTasks();
+    }
+    if (mParallelTimer != nullptr)
+    {
+        stats.skippedPeriodic += mParallelTimer->GetSkippedPeriodic();
+    }
+    if (mOverload != nullptr)
+    {
+        stats.overload = mOverload->GetReport();
+    }
+    return stats;
+}
+
+std::vector<WorkerStats> TaskScheduler::GetWorkerStats() const
+{
+    return mParallelRunner != nullptr ? mParallelRunner->GetWorkerStats() : std::vector<WorkerStats>{};
+}
+
+size_t TaskScheduler::GetParallelQueueDepth() const
+{
+    return mParallelRunner != nullptr ? mParallelRunner->GetQueueDepth() : 0U;
+}
+
+void TaskScheduler::WaitIdle()
+{
+    if (mParallelRunner != nullptr)
+    {
+        mParallelRunner->WaitIdle();
+    }
+}
+
+void TaskScheduler::Wait(const TaskGroup& group)
+{
+    if (mParallelRunner == nullptr)
+    {
+        if (!group.IsDone())
+        {
+            mLogger->Log<LogLevel::Warning>("[TaskScheduler::Wait] no parallel threads, the group only completes in ProcessTasks!");
+        }
+        return;
+    }
+    mParallelRunner->Wait(group);
+}
+
+void TaskScheduler::DumpTrace(std::ostream& out) const
+{
+    if (mTracer == nullptr)
+    {
+        out << "{\"traceEvents\":[]}\n"; // tracing is disabled, but keep the output loadable
+        return;
+    }
+    mTracer->DumpChromeTrace(out);
+}
+
+void TaskScheduler::AddTimedTask(std::chrono::nanoseconds duration, const TaskInfo& taskInfo)
+{
+    InsertTimedTask(Now() + duration, TaskInfo(taskInfo));
+}
+
+void TaskScheduler::AddTimedTask(std::chrono::nanoseconds duration, TaskInfo&& taskInfo)
+{
+    InsertTimedTask(Now() + duration, std::move(taskInfo));
+}
+
+void TaskScheduler::AddTimedTask(std::chrono::microseconds duration, const TaskInfo& taskInfo)
+{
+    InsertTimedTask(Now() + duration, TaskInfo(taskInfo));
+}
+
+void TaskScheduler::AddTimedTask(std::chrono::microseconds duration, TaskInfo&& taskInfo)
+{
+    InsertTimedTask(Now() + duration, std::move(taskInfo));
+}
+
 void TaskScheduler::AddTimedTask(std::chrono::milliseconds duration, const TaskInfo& taskInfo)
+{
+    InsertTimedTask(Now() + duration, TaskInfo(taskInfo));
+}
+
+void TaskScheduler::AddTimedTask(std::chrono::milliseconds duration, TaskInfo&& taskInfo)
+{
+    InsertTimedTask(Now() + duration, std::move(taskInfo));
+}
+
+void TaskScheduler::AddTimedTask(std::chrono::seconds duration, const TaskInfo& taskInfo)
+{
+    InsertTimedTask(Now() + duration, TaskInfo(taskInfo));
+}
+
+void TaskScheduler::AddTimedTask(std::chrono::seconds duration, TaskInfo&& taskInfo)
+{
+    InsertTimedTask(Now() + duration, std::move(taskInfo));
+}
+
+void TaskScheduler::InsertTimedTask(std::chrono::time_point<std::chrono::steady_clock> deadline, TaskInfo&& taskInfo,
+    std::chrono::time_point<std::chrono::steady_clock> notBefore)
 {
     if (taskInfo.callback == nullptr)
     {
-        std::cerr << "[TaskScheduler::AddTimedTask] callback is NULL!\n";
+        mLogger->Log<LogLevel::Error>("[TaskScheduler::AddTimedTask] callback is NULL!");
         return;
     }
-    mContainer->Insert({ taskInfo, duration });
+    if (taskInfo.group != nullptr && taskInfo.period <= std::chrono::nanoseconds::zero())
+    {
+        taskInfo.group->Enter(); // periodic ones count per occurrence
+    }
+    if (mParallelTimer != nullptr && !taskInfo.forceSynchronous)
+    {
+        mParallelTimer->Insert({ std::move(taskInfo), deadline, mNextSequence.fetch_add(1U, std::memory_order_relaxed), notBefore });
+        return; // of no concern to the main thread
+    }
+
+    const auto latest = std::max(deadline, notBefore) + taskInfo.slack;
+    bool earlier = false;
+    {
+        std::lock_guard lock(mInboxMutex);
+        mInbox.push_back({ std::move(taskInfo), deadline, mNextSequence.fetch_add(1U, std::memory_order_relaxed), notBefore });
+        if (mTracer != nullptr) { mTracer->Record(TraceEventType::Insert, mInbox.back()); }
+        earlier = (latest < mNextDeadline);
+        if (earlier) { mNextDeadline = latest; }
+#if defined(__linux__)
+        if (earlier && mEventFd != -1)
+        {
+            const uint64_t one = 1U;
+            [[maybe_unused]] ssize_t r = write(mEventFd, &one, sizeof(one)); // event loop calls `ProcessTasks`, which re-arms
+        }
+#endif
+    }
+    if (earlier)
+    {
+        mWakeCV.notify_all(); // a sleeping `WaitForNextDeadline` must wake up sooner
+    }
 }
 
-void TaskScheduler::AddTimedTask(std::chrono::seconds duration, const TaskInfo& taskInfo)
+void TaskScheduler::DrainInbox()
+{
+    {
+        std::lock_guard lock(mInboxMutex);
+        mInbox.swap(mInboxSwap);
+        mNextDeadline = std::chrono::time_point<std::chrono::steady_clock>::max(); // recomputed by iteration
+    }
+    for (TimedTaskInfo& timedTaskInfo : mInboxSwap)
+    {
+        if (!mContainer->Insert(std::move(timedTaskInfo)))
+        {
+            mLogger->Log<LogLevel::Error>("[TaskScheduler::ProcessTasks] container is full (maxSize), task is dropped!");
+            LeaveGroup(timedTaskInfo.taskInfo);
+        }
+    }
+    mInboxSwap.clear();
+}
+
+void TaskScheduler::Post(const TaskInfo& taskInfo)
+{
+    Post(TaskInfo(taskInfo));
+}
+
+void TaskScheduler::Post(TaskInfo&& taskInfo)
+{
+    if (mParallelRunner == nullptr)
+    {
+        PostToMain(std::move(taskInfo));
+        return;
+    }
+    if (taskInfo.callback == nullptr)
+    {
+        mLogger->Log<LogLevel::Error>("[TaskScheduler::Post] callback is NULL!");
+        return;
+    }
+    taskInfo.period = std::chrono::nanoseconds::zero();
+    if (mOverload != nullptr)
+    {
+        const OverloadAction action = mOverload->Admit(taskInfo.priority);
+        if (action == OverloadAction::Shed) { return; }
+        if (action == OverloadAction::Defer)
+        {
+            taskInfo.forceSynchronous = false;
+            const auto now = Now(); // due now, it only fires later
+            InsertTimedTask(now, std::move(taskInfo), now + mOverload->GetDeferBy());
+            return;
+        }
+    }
+    if (taskInfo.group != nullptr) { taskInfo.group->Enter(); }
+    // due right now, in clock time like everything the runner measures
+    mParallelRunner->RunTask({ std::move(taskInfo), mClock->Now(), mNextSequence.fetch_add(1U, std::memory_order_relaxed) });
+}
+
+void TaskScheduler::PostToMain(const TaskInfo& taskInfo)
+{
+    PostToMain(TaskInfo(taskInfo));
+}
+
+void TaskScheduler::PostToMain(TaskInfo&& taskInfo)
 {
     if (taskInfo.callback == nullptr)
     {
-        std::cerr << "[TaskScheduler::AddTimedTask] callback is NULL!\n";
+        mLogger->Log<LogLevel::Error>("[TaskScheduler::PostToMain] callback is NULL!");
         return;
     }
-    mContainer->Insert({ taskInfo, duration });
+    if (mOverload != nullptr)
+    {
+        const OverloadAction action = mOverload->Admit(taskInfo.priority);
+        if (action == OverloadAction::Shed) { return; }
+        if (action == OverloadAction::Defer)
+        {
+            taskInfo.forceSynchronous = true;
+            taskInfo.period = std::chrono::nanoseconds::zero();
+            const auto now = Now(); // due now, it only fires later
+            InsertTimedTask(now, std::move(taskInfo), now + mOverload->GetDeferBy());
+            return;
+        }
+    }
+    if (taskInfo.group != nullptr) { taskInfo.group->Enter(); }
+    PostedTask* node = ::new (mCallbackPool->Allocate(sizeof(PostedTask))) PostedTask();
+    node->task = { std::move(taskInfo), Now(), mNextSequence.fetch_add(1U, std::memory_order_relaxed) };
+    node->task.taskInfo.forceSynchronous = true;
+    node->task.taskInfo.period = std::chrono::nanoseconds::zero();
+    if (mTracer != nullptr) { mTracer->Record(TraceEventType::Insert, node->task); }
+    mPosted.Push(node);
+    if (mPostedCount.fetch_add(1U) != 0U) { return; } // someone already woke the host up
+
+    {
+        std::lock_guard lock(mInboxMutex);
+        mNextDeadline = std::min(mNextDeadline, node->task.deadline);
+#if defined(__linux__)
+        if (mEventFd != -1)
+        {
+            const uint64_t one = 1U;
+            [[maybe_unused]] ssize_t r = write(mEventFd, &one, sizeof(one));
+        }
+#endif
+    }
+    mWakeCV.notify_all();
+}
+
+void TaskScheduler::DrainPosted()
+{
+    // Exactly as many as were counted, waiting out pushes which are half way done
+    uint64_t count = mPostedCount.exchange(0U);
+    while (count > 0U)
+    {
+        PostedTask* node = mPosted.Pop();
+        if (node == nullptr) { std::this_thread::yield(); continue; }
+        count--;
+        mDeferred.push_back(std::move(node->task)); // run (and sorted) with the expired main-thread tasks
+        node->~PostedTask();
+        CallbackPool::Free(node);
+    }
+}
+
+bool TaskScheduler::WaitForNextDeadline(std::stop_token stopToken)
+{
+    if (!mDeferred.empty() || mPostedCount.load() != 0U)
+    {
+        return !stopToken.stop_requested(); // carried over or posted tasks are due already
+    }
+
+    std::unique_lock lock(mInboxMutex);
+    while (!stopToken.stop_requested())
+    {
+        const auto deadline = mNextDeadline;
+        if (deadline == std::chrono::time_point<std::chrono::steady_clock>::max())
+        {
+            // nothing scheduled, so sleep until someone adds a task
+            mWakeCV.wait(lock, stopToken, [&] { return mNextDeadline != deadline; });
+            continue; // re-read `mNextDeadline` (and the stop token), `deadline` is stale
+        }
+        else if (const auto clockDeadline = deadline + std::chrono::nanoseconds(mCatchUpOffset.load(std::memory_order_relaxed)); // including skipped stalls
+            mClock->Now() >= clockDeadline || mClock->SkipTo(clockDeadline))
+        {
+            mLastProcessed = mClock->Now(); // a stall is only counted from here, see `CatchUp`
+            return true; // a virtual clock is fast-forwarded instead of sleeping
+        }
+        else
+        {
+            mWakeCV.wait_until(lock, stopToken, clockDeadline, [&] { return mNextDeadline < deadline; });
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::RunUntil(std::stop_token stopToken)
+{
+    while (WaitForNextDeadline(stopToken))
+    {
+        ProcessTasks();
+    }
+}
+
+#if defined(__linux__)
+int TaskScheduler::GetPollFd()
+{
+    {
+        std::lock_guard lock(mInboxMutex);
+        if (mPollFd != -1) { return mPollFd; }
+
+        mPollFd = epoll_create1(EPOLL_CLOEXEC);
+        mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC); // same clock as std::chrono::steady_clock
+        mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (mPollFd == -1 || mTimerFd == -1 || mEventFd == -1)
+        {
+            mLogger->Log<LogLevel::Error>("[TaskScheduler::GetPollFd] failed to create file descriptors!");
+            if (mPollFd != -1) { close(mPollFd); }
+            if (mTimerFd != -1) { close(mTimerFd); }
+            if (mEventFd != -1) { close(mEventFd); }
+            mPollFd = mTimerFd = mEventFd = -1;
+            return -1;
+        }
+
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.fd = mTimerFd;
+        epoll_ctl(mPollFd, EPOLL_CTL_ADD, mTimerFd, &event);
+        event.data.fd = mEventFd;
+        epoll_ctl(mPollFd, EPOLL_CTL_ADD, mEventFd, &event);
+
+        // Readable right away instead of `ArmPollFd`, which reads state of the thread calling
+        // `ProcessTasks`. That call then re-arms it to the actual next deadline.
+        itimerspec spec {};
+        spec.it_value.tv_nsec = 1;
+        timerfd_settime(mTimerFd, 0, &spec, nullptr);
+        return mPollFd;
+    }
+}
+
+void TaskScheduler::ArmPollFd()
+{
+    std::lock_guard lock(mInboxMutex);
+    if (mPollFd == -1) { return; }
+
+    // Relative to our own clock, which need not be CLOCK_MONOTONIC (e.g. a `ManualClock`)
+    itimerspec spec {}; // all zero disarms the timer
+    if (!mDeferred.empty() || !mInbox.empty() || mPostedCount.load() != 0U)
+    {
+        spec.it_value.tv_nsec = 1; // due right away
+    }
+    else if (mNextDeadline != std::chrono::time_point<std::chrono::steady_clock>::max())
+    {
+        const auto ns = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(mNextDeadline - Now()).count(), 1);
+        spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+        spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+    }
+    timerfd_settime(mTimerFd, 0, &spec, nullptr);
 }
+#endif
 
 void TaskScheduler::Terminate(bool finishTasks)
 {
+    DrainInbox();
+    DrainPosted();
     if (finishTasks)
     {
+        for (const TimedTaskInfo& deferred : mDeferred) { RunOnMainThread(deferred); }
         mContainer->ForEach(std::bind(&TaskScheduler::ForceRunEachTask, this, std::placeholders::_1));
         mContainer->PostIterate();
     }
+    else
+    {
+        // Dropped, which completes them for their groups
+        for (const TimedTaskInfo& deferred : mDeferred) { LeaveGroup(deferred.taskInfo); }
+        mContainer->ForEach([this](TimedTaskInfo& timedTaskInfo) {
+            LeaveGroup(timedTaskInfo.taskInfo);
+            return true;
+        });
+        mContainer->PostIterate();
+    }
+    mDeferred.clear();
 
+    if (mParallelTimer != nullptr)
+    {
+        mParallelTimer->Terminate(finishTasks);
+    }
     if (mParallelRunner != nullptr)
     {
+        if (finishTasks) { mParallelRunner->WaitIdle(); } // with our help
         mParallelRunner->Terminate();
     }
     mRunning = false;
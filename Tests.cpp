@@ -0,0 +1,244 @@
+import TaskSchedulingModule;
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+// Regression tests for the task scheduler. No external dependencies, like `Benchmark.cpp` (see
+// README). Returns non-zero if any check fails.
+
+int gFailures = 0;
+
+#define CHECK(condition) \
+    do { if (!(condition)) { std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); gFailures++; } } while (false)
+
+// `RunUntil` on an empty scheduler sleeps until a task is added. Waking up (or stopping) from that
+// must not fast-forward a virtual clock to the end of time.
+void test_run_until_empty_keeps_manual_clock()
+{
+    const auto start = std::chrono::steady_clock::time_point(1h);
+    ManualClock clock(start);
+    TaskSchedulerInfo info;
+    info.numParallelThreads = 0U;
+    info.clock = &clock;
+    TaskScheduler scheduler(info);
+
+    std::atomic_bool ran = false;
+    std::jthread host([&](std::stop_token stopToken) { scheduler.RunUntil(stopToken); });
+    std::this_thread::sleep_for(50ms); // let it fall asleep on the empty schedule
+    std::thread poster([&] { scheduler.PostToMain({ [&] { ran = true; }, true }); });
+    poster.join();
+    while (!ran) { std::this_thread::yield(); }
+    CHECK(clock.Now() == start);
+
+    std::this_thread::sleep_for(50ms); // asleep on the empty schedule again
+    host.request_stop();
+    host.join();
+    CHECK(clock.Now() == start);
+    scheduler.Terminate();
+}
+
+// A task dropped outside of the parallel runner (here: the container is full) completes its group,
+// which must wake up a `Wait` on another thread.
+void test_dropped_task_wakes_group_wait()
+{
+    TaskSchedulerInfo info;
+    info.maxSize = 16U;
+    info.numParallelThreads = 1U;
+    TaskScheduler scheduler(info);
+    for (uint16_t i = 0; i < info.maxSize; i++) { scheduler.AddTimedTask(1h, { [] {}, false }); }
+
+    TaskGroup group;
+    TaskInfo dropped { [] {}, false };
+    dropped.group = &group;
+    scheduler.AddTimedTask(1h, std::move(dropped));
+
+    std::atomic_bool waited = false;
+    std::thread waiter([&] { scheduler.Wait(group); waited = true; });
+    std::this_thread::sleep_for(50ms); // let it fall asleep in `Wait`
+    scheduler.ProcessTasks(); // drops the task, there is no room for it
+    const auto giveUp = std::chrono::steady_clock::now() + 1s;
+    while (!waited && std::chrono::steady_clock::now() < giveUp) { std::this_thread::yield(); }
+    CHECK(waited);
+    CHECK(group.IsDone());
+
+    scheduler.Terminate(); // wakes the waiter in any case
+    waiter.join();
+}
+
+// The timer thread sleeps until the earliest deadline + slack of all its tasks, not just of the one
+// with the earliest deadline.
+void test_parallel_timer_wakes_up_for_slack()
+{
+    TaskSchedulerInfo info;
+    info.numParallelThreads = 1U;
+    info.parallelTimerThread = true;
+    TaskScheduler scheduler(info);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::atomic<std::chrono::steady_clock::time_point> ranAt = std::chrono::steady_clock::time_point::max();
+    TaskInfo lenient { [] {}, false };
+    lenient.slack = 300ms;
+    scheduler.AddTimedTask(10ms, std::move(lenient));
+    scheduler.AddTimedTask(20ms, { [&] { ranAt = std::chrono::steady_clock::now(); }, false });
+
+    while (ranAt.load() == std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() < start + 1s) { std::this_thread::yield(); }
+    CHECK(ranAt.load() < start + 200ms);
+    scheduler.Terminate();
+}
+
+// A main-thread task waiting for a resource fences off queued parallel tasks conflicting with it,
+// so a writer is not starved by a steady stream of overlapping readers.
+void test_main_thread_writer_not_starved()
+{
+    TaskSchedulerInfo info;
+    info.numParallelThreads = 3U;
+    TaskScheduler scheduler(info);
+
+    std::atomic_bool written = false;
+    std::thread feeder([&] {
+        const auto giveUp = std::chrono::steady_clock::now() + 2s;
+        while (!written && std::chrono::steady_clock::now() < giveUp)
+        {
+            TaskInfo reader { [] { std::this_thread::sleep_for(4ms); }, false };
+            reader.reads = 1U;
+            scheduler.Post(std::move(reader));
+            std::this_thread::sleep_for(2ms);
+        }
+    });
+    std::this_thread::sleep_for(50ms); // the readers overlap by now
+
+    const auto start = std::chrono::steady_clock::now();
+    TaskInfo writer { [&] { written = true; }, true };
+    writer.writes = 1U;
+    scheduler.PostToMain(std::move(writer));
+    while (!written) { scheduler.ProcessTasks(); }
+    CHECK(std::chrono::steady_clock::now() - start < 500ms);
+
+    feeder.join();
+    scheduler.Terminate();
+}
+
+// Tasks due at the same time fire in insertion order.
+void test_equal_deadlines_fire_in_insertion_order()
+{
+    ManualClock clock;
+    TaskSchedulerInfo info;
+    info.numParallelThreads = 0U;
+    info.clock = &clock;
+    TaskScheduler scheduler(info);
+
+    std::vector<int> order;
+    for (int i = 0; i < 8; i++) { scheduler.AddTimedTask(10ms, { [&order, i] { order.push_back(i); }, true }); }
+    clock.Advance(10ms);
+    scheduler.ProcessTasks();
+    CHECK(order == std::vector<int>({ 0, 1, 2, 3, 4, 5, 6, 7 }));
+    scheduler.Terminate();
+}
+
+// In fixed-timestep mode a task added by a callback in tick N, even one due right away, fires in tick N+1.
+void test_task_added_in_tick_fires_next_tick()
+{
+    TaskSchedulerInfo info;
+    info.numParallelThreads = 0U;
+    info.fixedTimestep = 10ms;
+    TaskScheduler scheduler(info);
+
+    uint64_t addedIn = 0U;
+    uint64_t firedIn = 0U;
+    scheduler.AddTickTask(2U, { [&] {
+        addedIn = scheduler.GetTick();
+        scheduler.AddTickTask(0U, { [&] { firedIn = scheduler.GetTick(); }, true });
+    }, true });
+    scheduler.ProcessTasks(5U);
+    CHECK(addedIn == 2U);
+    CHECK(firedIn == 3U);
+    scheduler.Terminate();
+}
+
+// A 10 ms periodic task at 10 ms frames, then a 1 s stall. Returns how often it fired in the frame
+// right after the stall, the scheduler runs `framesAfter` more frames.
+uint32_t run_stalled_periodic(CatchUpPolicy policy, uint32_t framesAfter, TaskSchedulerStats& stats)
+{
+    ManualClock clock;
+    TaskSchedulerInfo info;
+    info.numParallelThreads = 0U;
+    info.clock = &clock;
+    info.catchUpPolicy = policy;
+    info.maxCatchUp = 100ms;
+    info.catchUpFrames = 4U;
+    TaskScheduler scheduler(info);
+
+    uint32_t fired = 0U;
+    TaskInfo periodic { [&] { fired++; }, true };
+    periodic.period = 10ms;
+    scheduler.AddTimedTask(10ms, std::move(periodic));
+    for (int i = 0; i < 3; i++) { scheduler.ProcessTasks(); clock.Advance(10ms); } // fired at 10ms and 20ms
+    clock.Advance(1s - 10ms); // the next one is due at 30ms, the frame is at 1020ms
+    fired = 0U;
+    scheduler.ProcessTasks();
+    const uint32_t firedAfterStall = fired;
+    for (uint32_t i = 0; i < framesAfter; i++) { clock.Advance(10ms); scheduler.ProcessTasks(); }
+    stats = scheduler.GetStats();
+    scheduler.Terminate();
+    return firedAfterStall;
+}
+
+// Periodic tasks after a stall, under each `CatchUpPolicy`
+void test_periodic_catch_up_policies()
+{
+    TaskSchedulerStats stats;
+    CHECK(run_stalled_periodic(CatchUpPolicy::FireAll, 0U, stats) == 100U); // 30ms..1020ms
+    CHECK(stats.stalls == 1U);
+    CHECK(stats.catchUpDebt == 0us);
+
+    CHECK(run_stalled_periodic(CatchUpPolicy::SkipMissedPeriodic, 0U, stats) == 1U);
+    CHECK(stats.skippedPeriodic == 99U);
+
+    // 990ms overdue, 890ms of it are skipped: 30ms..130ms fire, and scheduler time stays behind
+    CHECK(run_stalled_periodic(CatchUpPolicy::Clamp, 8U, stats) == 11U);
+    CHECK(stats.catchUpDebt == 890ms);
+
+    // Same, but the skipped time is caught up within `catchUpFrames`
+    CHECK(run_stalled_periodic(CatchUpPolicy::Spread, 4U, stats) == 11U);
+    CHECK(stats.catchUpDebt == 0us);
+}
+
+// A low frame rate is no stall: a 1 s periodic task half a period out of phase with a 1 Hz loop is
+// always 500 ms late, but never skipped.
+void test_low_frame_rate_is_no_stall()
+{
+    ManualClock clock;
+    TaskSchedulerInfo info;
+    info.numParallelThreads = 0U;
+    info.clock = &clock;
+    info.catchUpPolicy = CatchUpPolicy::Clamp;
+    TaskScheduler scheduler(info);
+
+    TaskInfo periodic { [] {}, true };
+    periodic.period = 1s;
+    scheduler.AddTimedTask(500ms, std::move(periodic));
+    for (int i = 0; i < 10; i++) { scheduler.ProcessTasks(); clock.Advance(1s); }
+    const TaskSchedulerStats stats = scheduler.GetStats();
+    CHECK(stats.stalls == 0U);
+    CHECK(stats.catchUpDebt == 0us);
+    scheduler.Terminate();
+}
+
+int main()
+{
+    test_run_until_empty_keeps_manual_clock();
+    test_dropped_task_wakes_group_wait();
+    test_parallel_timer_wakes_up_for_slack();
+    test_main_thread_writer_not_starved();
+    test_equal_deadlines_fire_in_insertion_order();
+    test_task_added_in_tick_fires_next_tick();
+    test_periodic_catch_up_policies();
+    test_low_frame_rate_is_no_stall();
+
+    std::printf(gFailures == 0 ? "All tests passed\n" : "%d check(s) failed\n", gFailures);
+    return gFailures == 0 ? 0 : 1;
+}